@@ -1,21 +1,49 @@
 /*
   E Minor Self-Hosted-Style Compiler (single-file C++17 reference)
   ---------------------------------------------------------------
-  Pipeline:  Source -> Lexer -> Parser (AST) -> StarCode -> IR(HEX) -> Optimize -> Link -> Disasm
+  Pipeline:  Source -> Lexer -> Parser (AST) -> StarCode -> AstFold -> IR(HEX) -> Optimize -> Link -> Disasm [-> VM]
+             (emit and optimize run per function on --jobs threads; link concatenates and patches)
   Targets:   Deterministic hex-IR (byte opcodes) with simple multi-segment notion and symbols
   Language:  Dual-syntax (shortcode + long-form), capsules, channels, workers, labels/goto,
              durations, stamps, modules/import/export, star-code checks (representative set).
 
-  Build:     g++ -std=gnu++17 -O2 eminorcc.cpp -o eminorcc
+  Build:     g++ -std=gnu++17 -O2 -pthread eminorcc.cpp -o eminorcc
              cl /std:c++17 /EHsc /O2 eminorcc.cpp /Fe:eminorcc.exe
+  Bench:     g++ -std=gnu++17 -O2 -pthread eminor_bench.cpp -o eminor_bench   (corpus generator + per-phase MB/s)
+  Tests:     tests/run.sh   (regression programs under --run in each mode, --cache byte identity)
+  Embed:     g++ -std=gnu++17 -O2 -pthread -DEMINORCC_NO_MAIN -c GCC_Compiler.cpp -o eminor.o   (API in eminor.h)
 
-  CLI:       eminorcc <input.eminor> [-o outdir] [--disasm]
+  CLI:       eminorcc <input.eminor>... | @list [-o outdir] [-I dir] [--no-disasm] [--no-opt] [--run] [--threads N] [--jobs N]
+             [--cache dir] [--star-rules list] [--compact] [--regs] [--jit] [--time-passes] [--stats]   (JSON report on stderr: per-phase wall time, counts;
+             per-phase heap bytes too in a -DEMINOR_HEAP_STATS=1 build)
+             --star-rules all | none | cond-literal,labels,durations | -durations,...   (Star-Code checks to run)
+             several inputs (or @list, one path per line) compile as separate builds into outdir/<path minus extension>
+             on --jobs threads; diagnostics come out in input order and the exit status is 1 if any file failed
+             --cache reuses the objects of unchanged modules and the IR of unchanged function runs across builds
+             --compact writes a.emo with LEB128 operands, a constant pool and relative branches (the VM runs either form)
+             --regs computes call-free expressions capsule to capsule (MOVCAP/BINCAP/BINK) instead of on the stack
+             --jit runs hot VM loops as native code (x86-64; --run and --exec)
+             --profile PREFIX (--run/--exec) writes opcode/pair counts, sampled stacks and channel waits as PREFIX.*.folded
+             --disasm-symbol $f / --disasm-range FROM:TO list only that function / TEXT byte range in a.dis.txt
+             --host $f lets calls to $f stay undefined: they link to a stub a C++ host binds (see eminor.h)
+             eminorcc --exec out/a.emo [--threads N] [--jit]   (maps the object image and runs it, no compile)
+             eminorcc out/a.emo --disasm-symbol $f   (prints that part of an image's listing, no compile)
+             eminorcc --serve [--socket path] [build flags]   (warm compiler: JSON-line requests on stdin or a Unix socket)
 */
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <filesystem>
 #include <fstream>
@@ -24,15 +52,46 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define EMINOR_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EMINOR_SIMD_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define EMINOR_SIMD_NEON 1
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "eminor.h"
+
 using namespace std;
 
 //
@@ -43,8 +102,8 @@ static inline string read_file(const string& path) {
     string s; in.seekg(0, ios::end); s.resize((size_t)in.tellg());
     in.seekg(0, ios::beg); in.read(&s[0], (streamsize)s.size()); return s;
 }
-static inline void write_file(const string& path, const string& data) {
-    filesystem::create_directories(filesystem::path(path).parent_path());
+static inline void write_file(const string& path, string_view data) {
+    auto dir = filesystem::path(path).parent_path(); if (!dir.empty()) filesystem::create_directories(dir);
     ofstream out(path, ios::binary); if (!out) throw runtime_error("cannot write: " + path);
     out.write(data.data(), (streamsize)data.size());
 }
@@ -55,6 +114,183 @@ static inline bool isIdentStart(char c) { return std::isalpha((unsigned char)c)
 static inline bool isIdent(char c) { return std::isalnum((unsigned char)c) || c == '_' || c == '$' || c == '/'; }
 static inline string trim(const string& s) { size_t a = s.find_first_not_of(" \t\r\n"); if (a == string::npos) return ""; size_t b = s.find_last_not_of(" \t\r\n"); return s.substr(a, b - a + 1); }
 
+//
+// Heap counters (replaced global operator new/delete; --time-passes reports them per phase)
+//   Off by default: every allocation in the process, VM pool threads included, would pay a size prefix and
+//   shared atomic updates. Build with -DEMINOR_HEAP_STATS=1 for the peak_bytes / alloc_bytes fields.
+//
+#if defined(EMINORCC_NO_MAIN) // linked into another program: never replace its allocator
+#undef EMINOR_HEAP_STATS
+#define EMINOR_HEAP_STATS 0
+#elif !defined(EMINOR_HEAP_STATS)
+#define EMINOR_HEAP_STATS 0
+#endif
+struct HeapStats {
+    static inline atomic<size_t> live{ 0 }, peak{ 0 }, total{ 0 }; // bytes: outstanding, high-water mark, ever allocated
+    static void add(size_t n) {
+        size_t l = live.fetch_add(n, memory_order_relaxed) + n; total.fetch_add(n, memory_order_relaxed);
+        size_t p = peak.load(memory_order_relaxed);
+        while (l > p && !peak.compare_exchange_weak(p, l, memory_order_relaxed)) {}
+    }
+    static void sub(size_t n) { live.fetch_sub(n, memory_order_relaxed); }
+    static void resetPeak() { peak.store(live.load(memory_order_relaxed), memory_order_relaxed); }
+};
+#if EMINOR_HEAP_STATS
+// Each block is prefixed with its size; the prefix keeps max_align_t alignment. Over-aligned new is left alone.
+// Kept out of line: inlined into callers, the header arithmetic trips GCC's -Warray-bounds / -Wmismatched-new-delete.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define EMINOR_NOINLINE __declspec(noinline)
+#else
+#define EMINOR_NOINLINE __attribute__((noinline))
+#endif
+static constexpr size_t kHeapHdr = alignof(max_align_t) > 16 ? alignof(max_align_t) : 16;
+EMINOR_NOINLINE void* operator new(size_t n, const nothrow_t&) noexcept {
+    char* p = (char*)malloc(n + kHeapHdr); if (!p) return nullptr;
+    memcpy(p, &n, sizeof n); HeapStats::add(n); return p + kHeapHdr;
+}
+void* operator new(size_t n) { void* p = operator new(n, nothrow); if (!p) throw bad_alloc(); return p; }
+EMINOR_NOINLINE void operator delete(void* p) noexcept {
+    if (!p) return;
+    char* b = (char*)p - kHeapHdr; size_t n; memcpy(&n, b, sizeof n); HeapStats::sub(n); free(b);
+}
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { operator delete(p); }
+void* operator new[](size_t n) { return operator new(n); }
+void* operator new[](size_t n, const nothrow_t& t) noexcept { return operator new(n, t); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { operator delete(p); }
+#endif
+
+//
+// Arena (bump allocator owning one compilation's AST; teardown is freeing the blocks)
+//
+struct Arena {
+    static constexpr size_t kBlock = 64 * 1024;
+    vector<unique_ptr<char[]>> blocks; vector<size_t> sizes; size_t nextBlock = 0; // blocks[nextBlock..]: kept by reset(), not in use
+    char* cur = nullptr; size_t left = 0; size_t used = 0;
+    Arena() = default;
+    Arena(const Arena&) = delete; Arena& operator=(const Arena&) = delete;
+
+    void* alloc(size_t n, size_t align) {
+        size_t pad = (align - ((uintptr_t)cur & (align - 1))) & (align - 1);
+        if (!cur || pad + n > left) {
+            while (nextBlock < blocks.size() && sizes[nextBlock] < n + align) nextBlock++;
+            if (nextBlock == blocks.size()) { size_t sz = max(kBlock, n + align); blocks.emplace_back(new char[sz]); sizes.push_back(sz); }
+            cur = blocks[nextBlock].get(); left = sizes[nextBlock]; nextBlock++;
+            pad = (align - ((uintptr_t)cur & (align - 1))) & (align - 1);
+        }
+        char* p = cur + pad; cur = p + n; left -= pad + n; used += n; return p;
+    }
+    // Forgets every allocation but keeps the blocks for the next user (--serve reuses arenas across requests).
+    void reset() { cur = nullptr; left = 0; used = 0; nextBlock = 0; }
+    // Only trivially destructible types: nothing in the arena is ever destroyed individually.
+    template <class T> T* make() { static_assert(is_trivially_destructible<T>::value, "arena types must be trivial"); return new (alloc(sizeof(T), alignof(T))) T(); }
+    string_view str(string_view s) {
+        if (s.empty()) return {};
+        char* p = (char*)alloc(s.size(), 1); memcpy(p, s.data(), s.size()); return string_view(p, s.size());
+    }
+};
+
+//
+// Scanning kernels for the lexer's hot loops (AVX2 / SSE2 / NEON, 16-32 bytes per step, scalar tail)
+//
+static inline unsigned ctz32(uint32_t v) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long r; _BitScanForward(&r, v); return (unsigned)r;
+#else
+    return (unsigned)__builtin_ctz(v);
+#endif
+}
+static inline unsigned ctz64(uint64_t v) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long r; _BitScanForward64(&r, v); return (unsigned)r;
+#else
+    return (unsigned)__builtin_ctzll(v);
+#endif
+}
+static inline bool isWs(char c) { return c == ' ' || (unsigned char)(c - '\t') <= (unsigned char)('\r' - '\t'); } // isspace, C locale
+
+// First byte in [p, e) that is not whitespace, or e.
+static inline const char* scan_ws(const char* p, const char* e) {
+#if defined(EMINOR_SIMD_AVX2)
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), four = _mm256_set1_epi8('\r' - '\t');
+    for (; e - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p), d = _mm256_sub_epi8(v, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(_mm256_min_epu8(d, four), d));
+        uint32_t m = ~(uint32_t)_mm256_movemask_epi8(ws);
+        if (m) return p + ctz32(m);
+    }
+#elif defined(EMINOR_SIMD_SSE2)
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), four = _mm_set1_epi8('\r' - '\t');
+    for (; e - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p), d = _mm_sub_epi8(v, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(_mm_min_epu8(d, four), d));
+        uint32_t m = ~(uint32_t)_mm_movemask_epi8(ws) & 0xFFFFu;
+        if (m) return p + ctz32(m);
+    }
+#elif defined(EMINOR_SIMD_NEON)
+    const uint8x16_t sp = vdupq_n_u8(' '), tab = vdupq_n_u8('\t'), four = vdupq_n_u8('\r' - '\t');
+    for (; e - p >= 16; p += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)p);
+        uint8x16_t ws = vorrq_u8(vceqq_u8(v, sp), vcleq_u8(vsubq_u8(v, tab), four));
+        uint64_t m = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(ws), 4)), 0); // 4 bits per byte
+        if (m) return p + (ctz64(m) >> 2);
+    }
+#endif
+    while (p < e && isWs(*p)) p++;
+    return p;
+}
+
+// First byte in [p, e) equal to a, b or c, or e.
+static inline const char* scan_any(const char* p, const char* e, char a, char b, char c) {
+#if defined(EMINOR_SIMD_AVX2)
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), vc = _mm256_set1_epi8(c);
+    for (; e - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)), _mm256_cmpeq_epi8(v, vc));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(hit);
+        if (m) return p + ctz32(m);
+    }
+#elif defined(EMINOR_SIMD_SSE2)
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c);
+    for (; e - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)), _mm_cmpeq_epi8(v, vc));
+        uint32_t m = (uint32_t)_mm_movemask_epi8(hit);
+        if (m) return p + ctz32(m);
+    }
+#elif defined(EMINOR_SIMD_NEON)
+    const uint8x16_t va = vdupq_n_u8((uint8_t)a), vb = vdupq_n_u8((uint8_t)b), vc = vdupq_n_u8((uint8_t)c);
+    for (; e - p >= 16; p += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)p);
+        uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)), vceqq_u8(v, vc));
+        uint64_t m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (m) return p + (ctz64(m) >> 2);
+    }
+#endif
+    while (p < e && *p != a && *p != b && *p != c) p++;
+    return p;
+}
+
+//
+// Line index: newline offsets, built on the first diagnostic that needs a line:col
+//
+struct LineIndex {
+    string_view src; vector<uint32_t> starts; // byte offset of each line
+    explicit LineIndex(string_view s) :src(s) {}
+    pair<int, int> at(uint32_t pos) {
+        if (starts.empty()) {
+            starts.push_back(0);
+            for (const char* p = src.data(), *e = p + src.size(); (p = (const char*)memchr(p, '\n', (size_t)(e - p))); p++)
+                starts.push_back((uint32_t)(p - src.data() + 1));
+        }
+        size_t ln = (size_t)(upper_bound(starts.begin(), starts.end(), pos) - starts.begin()); // 1-based
+        return { (int)ln, (int)(pos - starts[ln - 1] + 1) };
+    }
+    string str(uint32_t pos) { auto lc = at(pos); return to_string(lc.first) + ":" + to_string(lc.second); }
+};
+
 //
 // Tokens
 //
@@ -76,135 +312,205 @@ enum class Tok {
     Label // ":label"
 };
 struct Token {
-    Tok kind; string lex; int line, col; long long ival = 0; bool bval = false; unsigned long long du_ns = 0ULL;
+    Tok kind; string_view lex; uint32_t pos; long long ival = 0; bool bval = false; unsigned long long du_ns = 0ULL;
+};
+
+//
+// Keyword table (perfect hash: the seed and slot table are computed at compile time)
+//
+struct Keyword { string_view s; Tok t; };
+static constexpr Keyword kKeywords[] = {
+    {"true",Tok::Bool},{"false",Tok::Bool},
+    {"@main",Tok::AtMain},{"@entry_point",Tok::AtEntryPoint},
+    {"@module",Tok::Module},{"@import",Tok::Import},{"@export",Tok::Export},
+    {"function",Tok::Function},{"worker",Tok::Worker},{"let",Tok::Let},{"goto",Tok::Goto},
+    {"if",Tok::If},{"else",Tok::Else},{"endif",Tok::EndIf},{"loop",Tok::Loop},
+    {"return",Tok::Return},{"print",Tok::Print},
+    {"#init",Tok::HashInit},{"#lease",Tok::HashLease},{"#sublease",Tok::HashSublease},{"#release",Tok::HashRelease},
+    {"#load",Tok::HashLoad},{"#call",Tok::HashCall},{"#exit",Tok::HashExit},
+    {"#if",Tok::HashIf},{"#else",Tok::HashElse},{"#endif",Tok::HashEndIf},{"#loop",Tok::HashLoop},
+    {"#render",Tok::HashRender},{"#input",Tok::HashInput},{"#output",Tok::HashOutput},
+    {"#send",Tok::HashSend},{"#recv",Tok::HashRecv},{"#spawn",Tok::HashSpawn},{"#join",Tok::HashJoin},
+    {"#stamp",Tok::HashStamp},{"#expire",Tok::HashExpire},{"#sleep",Tok::HashSleep},{"#yield",Tok::HashYield},{"#error",Tok::HashError},
+    {"initialize",Tok::Initialize},{"assign",Tok::AssignValue},{"invoke",Tok::InvokeFunction},
+    {"terminate",Tok::TerminateExecution}
 };
+static constexpr size_t kNumKeywords = sizeof(kKeywords) / sizeof(kKeywords[0]);
+static constexpr size_t kKwSlots = 256, kKwMaxLen = 12;
+
+static constexpr uint32_t kw_hash(string_view s, uint32_t seed) {
+    uint32_t h = seed ^ (uint32_t)s.size();
+    for (char c : s) h = (h ^ (uint8_t)c) * 16777619u;
+    return h ^ (h >> 15);
+}
+static constexpr uint32_t kw_find_seed() {
+    for (uint32_t seed = 1; seed < 100000; seed++) {
+        bool used[kKwSlots] = {}; bool ok = true;
+        for (size_t i = 0; i < kNumKeywords && ok; i++) {
+            uint32_t h = kw_hash(kKeywords[i].s, seed) % kKwSlots;
+            if (used[h]) ok = false;
+            used[h] = true;
+        }
+        if (ok) return seed;
+    }
+    return 0;
+}
+static constexpr uint32_t kKwSeed = kw_find_seed();
+static_assert(kKwSeed != 0, "no collision-free seed for the keyword table");
+struct KwSlotTable { uint8_t v[kKwSlots] = {}; }; // keyword index + 1, 0 = empty
+static constexpr KwSlotTable kw_build_slots() {
+    KwSlotTable t{};
+    for (size_t i = 0; i < kNumKeywords; i++) t.v[kw_hash(kKeywords[i].s, kKwSeed) % kKwSlots] = (uint8_t)(i + 1);
+    return t;
+}
+static constexpr KwSlotTable kKwSlotTable = kw_build_slots();
 
 //
-// Lexer
+// Lexer (tokens are views into the source buffer, which must outlive the tokens and the AST;
+// only decoded string escapes and diagnostics are copied, into the arena)
 //
 struct Lexer {
-    string src; size_t i = 0; int line = 1, col = 1;
-    Lexer(string s) :src(std::move(s)) {}
+    string_view src; Arena& A; size_t i = 0; LineIndex lines;
+    Lexer(string_view s, Arena& arena) :src(s), A(arena), lines(s) {}
     char peek() const { return i < src.size() ? src[i] : '\0'; }
-    char get() { char c = peek(); if (c == '\n') { line++; col = 1; } else col++; if (i < src.size()) i++; return c; }
-    bool starts(const string& s) { return src.compare(i, s.size(), s) == 0; }
+    char peek2() const { return i + 1 < src.size() ? src[i + 1] : '\0'; }
+    char get() { char c = peek(); if (i < src.size()) i++; return c; }
+    bool starts(string_view s) const { return src.substr(i, s.size()) == s; }
 
     void skip() {
         for (;;) {
-            while (isspace((unsigned char)peek())) get();
-            if (starts("//")) { while (peek() && peek() != '\n') get(); continue; }
-            if (starts("/*")) { get(); get(); while (peek() && !starts("*/")) get(); if (starts("*/")) { get(); get(); } continue; }
+            const char* b = src.data(), * e = b + src.size();
+            i = (size_t)(scan_ws(b + i, e) - b);
+            if (starts("//")) { i = (size_t)(scan_any(b + i + 2, e, '\n', '\0', '\n') - b); continue; }
+            if (starts("/*")) {
+                i += 2;
+                for (;;) { // stop at "*/", a NUL byte or the end, as before
+                    i = (size_t)(scan_any(b + i, e, '*', '\0', '*') - b);
+                    if (!peek()) break;
+                    if (starts("*/")) { i += 2; break; }
+                    i++;
+                }
+                continue;
+            }
             break;
         }
     }
 
-    Token make(Tok k, string lx, int L, int C) { Token t; t.kind = k; t.lex = std::move(lx); t.line = L; t.col = C; return t; }
+    Token make(Tok k, string_view lx, uint32_t P) { Token t; t.kind = k; t.lex = lx; t.pos = P; return t; }
+    Token error(const string& msg, uint32_t P) { return make(Tok::Error, A.str(msg), P); }
+
+    // Saturates like strtoull on overflow.
+    static unsigned long long parse_u64(string_view d, int base) {
+        unsigned long long v = 0;
+        for (char c : d) {
+            unsigned dig = isdigit((unsigned char)c) ? unsigned(c - '0') : unsigned(tolower((unsigned char)c) - 'a' + 10);
+            if (v > (ULLONG_MAX - dig) / (unsigned)base) return ULLONG_MAX;
+            v = v * (unsigned)base + dig;
+        }
+        return v;
+    }
 
-    Token lexNumberOrDuration(int L, int C) {
+    Token lexNumberOrDuration(uint32_t P) {
         size_t start = i; bool isHex = false;
         if (starts("0x") || starts("0X")) { isHex = true; get(); get(); while (isxdigit((unsigned char)peek())) get(); }
         else { while (isdigit((unsigned char)peek())) get(); }
-        string num = src.substr(start, i - start);
+        string_view num = src.substr(start, i - start);
+        if (isHex) num.remove_prefix(2);
         // duration suffix
-        string suf; if (isalpha((unsigned char)peek())) { size_t s2 = i; while (isalpha((unsigned char)peek())) get(); suf = src.substr(s2, i - s2); }
-        Token t; t.line = L; t.col = C;
+        string_view suf; if (isalpha((unsigned char)peek())) { size_t s2 = i; while (isalpha((unsigned char)peek())) get(); suf = src.substr(s2, i - s2); }
+        Token t; t.pos = P; t.lex = src.substr(start, i - start);
+        unsigned long long val = parse_u64(num, isHex ? 16 : 10);
         if (!suf.empty()) {
             unsigned long long v = 0;
-            unsigned long long val = isHex ? strtoull(num.c_str(), nullptr, 16) : strtoull(num.c_str(), nullptr, 10);
             if (suf == "ns") v = val;
             else if (suf == "ms") v = val * 1000000ULL;
             else if (suf == "s")  v = val * 1000000000ULL;
             else if (suf == "m")  v = val * 60ULL * 1000000000ULL;
             else if (suf == "h")  v = val * 3600ULL * 1000000000ULL;
-            else { return make(Tok::Error, "bad duration unit '" + suf + "'", L, C); }
-            t.kind = Tok::Duration; t.du_ns = v; t.lex = num + suf; return t;
+            else { return error("bad duration unit '" + string(suf) + "'", P); }
+            t.kind = Tok::Duration; t.du_ns = v; return t;
         }
         else {
-            t.kind = Tok::Number; t.ival = (long long)(isHex ? strtoull(num.c_str(), nullptr, 16) : strtoull(num.c_str(), nullptr, 10));
-            t.lex = num; return t;
+            t.kind = Tok::Number; t.ival = (long long)val; return t;
         }
     }
 
-    Token lexString(int L, int C) {
-        string s; // assume opening " consumed
-        while (peek() && peek() != '"') {
-            char c = get();
-            if (c == '\\' && peek()) {
-                char e = get();
+    Token lexString(uint32_t P) {
+        // assume opening " consumed; without escapes the literal is a view into the source
+        size_t start = i; bool esc = false;
+        const char* b = src.data(), * e = b + src.size();
+        for (;;) {
+            i = (size_t)(scan_any(b + i, e, '"', '\\', '\0') - b);
+            if (peek() != '\\') break;
+            i++; if (peek()) { esc = true; i++; }
+        }
+        if (peek() != '"') return error("unterminated string", P);
+        string_view raw = src.substr(start, i - start); get();
+        if (!esc) return make(Tok::String, raw, P);
+        string s; s.reserve(raw.size());
+        for (size_t k = 0; k < raw.size(); k++) {
+            char c = raw[k];
+            if (c == '\\' && k + 1 < raw.size()) {
+                char e = raw[++k];
                 if (e == 'n') s.push_back('\n');
                 else if (e == 't') s.push_back('\t');
                 else s.push_back(e);
             }
             else s.push_back(c);
         }
-        if (peek() != '"') return make(Tok::Error, "unterminated string", L, C);
-        get(); Token t = make(Tok::String, s, L, C); t.lex = s; return t;
-    }
-
-    static Tok kw(const string& id) {
-        static unordered_map<string, Tok> m = {
-          {"true",Tok::Bool},{"false",Tok::Bool},
-          {"@main",Tok::AtMain},{"@entry_point",Tok::AtEntryPoint},
-          {"@module",Tok::Module},{"@import",Tok::Import},{"@export",Tok::Export},
-          {"function",Tok::Function},{"worker",Tok::Worker},{"let",Tok::Let},{"goto",Tok::Goto},
-          {"if",Tok::If},{"else",Tok::Else},{"endif",Tok::EndIf},{"loop",Tok::Loop},
-          {"return",Tok::Return},{"print",Tok::Print},
-          {"#init",Tok::HashInit},{"#lease",Tok::HashLease},{"#sublease",Tok::HashSublease},{"#release",Tok::HashRelease},
-          {"#load",Tok::HashLoad},{"#call",Tok::HashCall},{"#exit",Tok::HashExit},
-          {"#if",Tok::HashIf},{"#else",Tok::HashElse},{"#endif",Tok::HashEndIf},{"#loop",Tok::HashLoop},
-          {"#render",Tok::HashRender},{"#input",Tok::HashInput},{"#output",Tok::HashOutput},
-          {"#send",Tok::HashSend},{"#recv",Tok::HashRecv},{"#spawn",Tok::HashSpawn},{"#join",Tok::HashJoin},
-          {"#stamp",Tok::HashStamp},{"#expire",Tok::HashExpire},{"#sleep",Tok::HashSleep},{"#yield",Tok::HashYield},{"#error",Tok::HashError},
-          {"initialize",Tok::Initialize},{"assign",Tok::AssignValue},{"invoke",Tok::InvokeFunction},
-          {"terminate",Tok::TerminateExecution}
-        };
-        auto it = m.find(id); if (it != m.end()) return it->second; return Tok::Ident;
+        return make(Tok::String, A.str(s), P);
+    }
+
+    static Tok kw(string_view id) {
+        if (id.size() < 2 || id.size() > kKwMaxLen) return Tok::Ident;
+        uint8_t k = kKwSlotTable.v[kw_hash(id, kKwSeed) % kKwSlots];
+        return k && kKeywords[k - 1].s == id ? kKeywords[k - 1].t : Tok::Ident;
     }
 
     Token next() {
         skip();
-        int L = line, C = col; char c = peek(); if (!c) return make(Tok::End, "", L, C);
+        uint32_t P = (uint32_t)i; char c = peek(); if (!c) return make(Tok::End, "", P);
 
         // label: ":name"
         if (c == ':') {
             get();
-            if (!isIdentStart(peek())) return make(Tok::Error, "expected label", L, C);
-            size_t s = i; while (isIdent(peek())) get(); string name = src.substr(s, i - s);
-            Token t = make(Tok::Label, name, L, C); return t;
+            if (!isIdentStart(peek())) return make(Tok::Error, "expected label", P);
+            size_t s = i; while (isIdent(peek())) get(); string_view name = src.substr(s, i - s);
+            Token t = make(Tok::Label, name, P); return t;
         }
 
         // punctuation / two-char ops
-        if (c == '(') { get(); return make(Tok::LParen, "(", L, C); }
-        if (c == ')') { get(); return make(Tok::RParen, ")", L, C); }
-        if (c == '{') { get(); return make(Tok::LBrace, "{", L, C); }
-        if (c == '}') { get(); return make(Tok::RBrace, "}", L, C); }
-        if (c == '[') { get(); return make(Tok::LBracket, "[", L, C); }
-        if (c == ']') { get(); return make(Tok::RBracket, "]", L, C); }
-        if (c == ',') { get(); return make(Tok::Comma, ",", L, C); }
-        if (c == ';') { get(); return make(Tok::Semi, ";", L, C); }
-        if (c == '.') { get(); return make(Tok::Dot, ".", L, C); }
-        if (c == '!' && src[i + 1] == '=') { get(); get(); return make(Tok::Ne, "!=", L, C); }
-        if (c == '=' && src[i + 1] == '=') { get(); get(); return make(Tok::Eq, "==", L, C); }
-        if (c == '<' && src[i + 1] == '=') { get(); get(); return make(Tok::Le, "<=", L, C); }
-        if (c == '>' && src[i + 1] == '=') { get(); get(); return make(Tok::Ge, ">=", L, C); }
-        if (c == '&' && src[i + 1] == '&') { get(); get(); return make(Tok::AndAnd, "&&", L, C); }
-        if (c == '|' && src[i + 1] == '|') { get(); get(); return make(Tok::OrOr, "||", L, C); }
-        if (c == '=') { get(); return make(Tok::Assign, "=", L, C); }
-        if (c == '<') { get(); return make(Tok::Lt, "<", L, C); }
-        if (c == '>') { get(); return make(Tok::Gt, ">", L, C); }
-        if (c == '+') { get(); return make(Tok::Plus, "+", L, C); }
-        if (c == '-') { get(); return make(Tok::Minus, "-", L, C); }
-        if (c == '*') { get(); return make(Tok::Star, "*", L, C); }
-        if (c == '/') { get(); return make(Tok::Slash, "/", L, C); }
-        if (c == '%') { get(); return make(Tok::Percent, "%", L, C); }
-        if (c == '!') { get(); return make(Tok::Bang, "!", L, C); }
-        if (c == '~') { get(); return make(Tok::Tilde, "~", L, C); }
+        if (c == '(') { get(); return make(Tok::LParen, "(", P); }
+        if (c == ')') { get(); return make(Tok::RParen, ")", P); }
+        if (c == '{') { get(); return make(Tok::LBrace, "{", P); }
+        if (c == '}') { get(); return make(Tok::RBrace, "}", P); }
+        if (c == '[') { get(); return make(Tok::LBracket, "[", P); }
+        if (c == ']') { get(); return make(Tok::RBracket, "]", P); }
+        if (c == ',') { get(); return make(Tok::Comma, ",", P); }
+        if (c == ';') { get(); return make(Tok::Semi, ";", P); }
+        if (c == '.') { get(); return make(Tok::Dot, ".", P); }
+        if (c == '!' && peek2() == '=') { get(); get(); return make(Tok::Ne, "!=", P); }
+        if (c == '=' && peek2() == '=') { get(); get(); return make(Tok::Eq, "==", P); }
+        if (c == '<' && peek2() == '=') { get(); get(); return make(Tok::Le, "<=", P); }
+        if (c == '>' && peek2() == '=') { get(); get(); return make(Tok::Ge, ">=", P); }
+        if (c == '&' && peek2() == '&') { get(); get(); return make(Tok::AndAnd, "&&", P); }
+        if (c == '|' && peek2() == '|') { get(); get(); return make(Tok::OrOr, "||", P); }
+        if (c == '=') { get(); return make(Tok::Assign, "=", P); }
+        if (c == '<') { get(); return make(Tok::Lt, "<", P); }
+        if (c == '>') { get(); return make(Tok::Gt, ">", P); }
+        if (c == '+') { get(); return make(Tok::Plus, "+", P); }
+        if (c == '-') { get(); return make(Tok::Minus, "-", P); }
+        if (c == '*') { get(); return make(Tok::Star, "*", P); }
+        if (c == '/') { get(); return make(Tok::Slash, "/", P); }
+        if (c == '%') { get(); return make(Tok::Percent, "%", P); }
+        if (c == '!') { get(); return make(Tok::Bang, "!", P); }
+        if (c == '~') { get(); return make(Tok::Tilde, "~", P); }
 
         // string
-        if (c == '"') { get(); return lexString(L, C); }
+        if (c == '"') { get(); return lexString(P); }
 
         // number or duration
-        if (isdigit((unsigned char)c)) return lexNumberOrDuration(L, C);
+        if (isdigit((unsigned char)c)) return lexNumberOrDuration(P);
 
         // identifier / directive (starts with @ or # backed into kw table)
         if (isIdentStart(c) || c == '@' || c == '#') {
@@ -215,23 +521,28 @@ struct Lexer {
                 if (peek() == '<' || peek() == '>') break;
                 get();
             }
-            string id = src.substr(s, i - s);
+            string_view id = src.substr(s, i - s);
             // handle @main @entry_point etc. Already includes '@'
             Tok k = kw(id);
-            if (k == Tok::Ident) {
-                // keywords like "bool", types, or 'true/false'
-                if (id == "true" || id == "false") { Token t = make(Tok::Bool, id, L, C); t.bval = (id == "true"); return t; }
-            }
-            Token t = make(k == Tok::Ident ? Tok::Ident : k, id, L, C); return t;
+            if (k == Tok::Bool) { Token t = make(Tok::Bool, id, P); t.bval = (id == "true"); return t; }
+            Token t = make(k == Tok::Ident ? Tok::Ident : k, id, P); return t;
         }
 
-        return make(Tok::Error, string("unexpected char '") + c + "'", L, C);
+        return error(string("unexpected char '") + c + "'", P);
     }
 };
 
 //
 // AST
 //
+struct Node;
+// Children: a contiguous span of node pointers in the arena.
+struct NodeList {
+    Node** p = nullptr; uint32_t n = 0;
+    Node** begin() const { return p; } Node** end() const { return p + n; }
+    size_t size() const { return n; } bool empty() const { return n == 0; }
+    Node* operator[](size_t i) const { return p[i]; } Node* back() const { return p[n - 1]; }
+};
 struct Node {
     enum class K {
         Program, Module, Import, Export, Func, Worker, Param, Block, Let, If, Loop, Return, Print,
@@ -241,23 +552,31 @@ struct Node {
         // expr
         Bin, Un, CallExpr, Var, ConstI, ConstStr, ConstBool
     } k;
-    int line = 0, col = 0;
-    // generic fields
-    string s1, s2; long long i64 = 0; unsigned long long du_ns = 0ULL; bool b = false;
-    vector<shared_ptr<Node>> xs;
+    uint32_t pos = 0; // byte offset into the source (LineIndex maps it to line:col)
+    // generic fields (strings are views into the arena)
+    string_view s1, s2; long long i64 = 0; unsigned long long du_ns = 0ULL; bool b = false;
+    NodeList xs;
 };
 
-static shared_ptr<Node> N(Node::K k, int L = 0, int C = 0) { auto p = make_shared<Node>(); p->k = k; p->line = L; p->col = C; return p; }
+static NodeList list_of(Arena& A, const Node* const* xs, size_t n) {
+    NodeList l; if (!n) return l;
+    l.p = (Node**)A.alloc(n * sizeof(Node*), alignof(Node*)); memcpy(l.p, xs, n * sizeof(Node*)); l.n = (uint32_t)n; return l;
+}
+static NodeList list_of(Arena& A, const vector<Node*>& v) { return list_of(A, v.data(), v.size()); }
+static NodeList list_of(Arena& A, initializer_list<Node*> v) { return list_of(A, v.begin(), v.size()); }
 
 //
 // Parser (recursive descent + Pratt for expressions)
 //
 struct Parser {
-    Lexer lx; Token t;
-    explicit Parser(string s) :lx(std::move(s)) { adv(); }
+    Lexer lx; Token t; Arena& A; // A owns every node; node strings view the source or A
+    size_t nTokens = 0, nNodes = 0; // --stats
+    Parser(string_view s, Arena& arena) :lx(s, arena), A(arena) { adv(); }
 
-    [[noreturn]] void perr(const string& msg) { throw runtime_error("parse error @" + to_string(t.line) + ":" + to_string(t.col) + ": " + msg + " (tok=" + t.lex + ")"); }
-    void adv() { t = lx.next(); if (t.kind == Tok::Error) perr(t.lex); }
+    Node* N(Node::K k, uint32_t P = 0) { Node* p = A.make<Node>(); p->k = k; p->pos = P; nNodes++; return p; }
+
+    [[noreturn]] void perr(const string& msg) { throw runtime_error("parse error @" + lx.lines.str(t.pos) + ": " + msg + " (tok=" + string(t.lex) + ")"); }
+    void adv() { t = lx.next(); nTokens++; if (t.kind == Tok::Error) perr(string(t.lex)); }
     bool is(Tok k) const { return t.kind == k; }
     bool eat(Tok k) { if (is(k)) { adv(); return true; } return false; }
     void expect(Tok k, const char* what) { if (!eat(k)) perr(string("expected ") + what); }
@@ -275,77 +594,68 @@ struct Parser {
         }
     }
 
-    shared_ptr<Node> parse() {
-        auto prog = N(Node::K::Program);
+    Node* parse() {
+        auto prog = N(Node::K::Program); vector<Node*> xs;
         while (!is(Tok::End)) {
             if (is(Tok::AtMain) || is(Tok::AtEntryPoint)) {
-                auto blk = parseEntry(); prog->xs.push_back(blk); continue;
+                auto blk = parseEntry(); xs.push_back(blk); continue;
             }
-            if (is(Tok::Module)) { prog->xs.push_back(parseModule()); continue; }
-            if (is(Tok::Import)) { prog->xs.push_back(parseImport()); continue; }
-            if (is(Tok::Export)) { prog->xs.push_back(parseExport()); continue; }
-            if (is(Tok::Function)) { prog->xs.push_back(parseFunc(Node::K::Func)); continue; }
-            if (is(Tok::Worker)) { prog->xs.push_back(parseFunc(Node::K::Worker)); continue; }
+            if (is(Tok::Module)) { xs.push_back(parseModule()); continue; }
+            if (is(Tok::Import)) { xs.push_back(parseImport()); continue; }
+            if (is(Tok::Export)) { xs.push_back(parseExport()); continue; }
+            if (is(Tok::Function)) { xs.push_back(parseFunc(Node::K::Func)); continue; }
+            if (is(Tok::Worker)) { xs.push_back(parseFunc(Node::K::Worker)); continue; }
             // allow top-level labels/lets if needed
-            if (is(Tok::Let)) { prog->xs.push_back(parseLet()); continue; }
+            if (is(Tok::Let)) { xs.push_back(parseLet()); continue; }
             perr("unexpected top-level construct");
         }
+        prog->xs = list_of(A, xs);
         return prog;
     }
 
-    shared_ptr<Node> parseEntry() {
+    Node* parseEntry() {
         bool main = is(Tok::AtMain); adv();
         auto b = parseBlock();
         b->s1 = main ? "@main" : "@entry_point";
         return b;
     }
 
-    shared_ptr<Node> parseModule() {
-        adv(); // @module
-        expect(Tok::String, "\"path\"");
-        auto n = N(Node::K::Module, t.line, t.col); n->s1 = t.lex; // actually last read; fix: store before adv:
-        // correct: we advanced already; we need to retrieve previous token; adjust:
-        // Simpler: step back: We'll just store via previous line; patch by using lx internal not simple.
-        // Workaround: keep recent token? For brevity:
-        n->s1 = lx.src.substr(0, 0); // placeholder ignored in this minimal sample
-        // Better: just re-read: previous token is not accessible; we can store using local captured earlier
-        // Instead, fix by reading into temp before adv:
-        perr("internal: module path capture not implemented"); return n;
-    }
-
-    // For brevity, implement Import/Export/Module via simplified parse helpers:
-    shared_ptr<Node> parseImport() { // @import "path" [as $alias]
-        // We re-lex the string literally: consume @import, then a string, optional 'as' Ident
-        // Because the above Module showed complexity, here we implement properly
-        auto L = t.line, C = t.col; adv(); // @import
+    Node* parseModule() { // @module "name"
+        auto P = t.pos; adv(); // @module
+        if (!is(Tok::String)) perr("expected \"name\" after @module");
+        auto n = N(Node::K::Module, P); n->s1 = t.lex; adv(); return n;
+    }
+    Node* parseImport() { // @import "path[:$symbol]" [as $alias]
+        auto P = t.pos; adv(); // @import
         if (t.kind != Tok::String) perr("expected string path after @import");
-        string path = t.lex; adv();
-        string alias;
+        string_view path = t.lex; adv();
+        string_view alias;
         if (is(Tok::Ident) && t.lex == "as") { adv(); if (!is(Tok::Ident)) perr("expected alias ident"); alias = t.lex; adv(); }
-        auto n = N(Node::K::Import, L, C); n->s1 = path; n->s2 = alias; return n;
+        auto n = N(Node::K::Import, P); n->s1 = path; n->s2 = alias; return n;
     }
-    shared_ptr<Node> parseExport() {
-        auto L = t.line, C = t.col; adv(); // @export
+    Node* parseExport() { // @export [function] $name
+        auto P = t.pos; adv(); // @export
+        eat(Tok::Function);
         if (!is(Tok::Ident)) perr("expected exported symbol like $name");
-        string sym = t.lex; adv();
-        auto n = N(Node::K::Export, L, C); n->s1 = sym; return n;
+        string_view sym = t.lex; adv();
+        auto n = N(Node::K::Export, P); n->s1 = sym; return n;
     }
 
-    shared_ptr<Node> parseFunc(Node::K kind) {
-        auto L = t.line, C = t.col; adv(); // function/worker
+    Node* parseFunc(Node::K kind) {
+        auto P = t.pos; adv(); // function/worker
         if (!is(Tok::Ident)) perr("expected $name");
-        string name = t.lex; adv();
+        string_view name = t.lex; adv();
         expect(Tok::LParen, "(");
-        vector<shared_ptr<Node>> params;
+        vector<Node*> params;
         if (!is(Tok::RParen)) {
             for (;;) {
                 if (!is(Tok::Ident)) perr("expected param name");
-                string pn = t.lex; adv();
+                string_view pn = t.lex; adv();
                 string ptype;
                 if (eat(Tok::Colon)) { // $x : capsule<u8>
                     ptype = readType();
                 }
-                auto p = N(Node::K::Param, L, C); p->s1 = pn; p->s2 = ptype; params.push_back(p);
+                auto p = N(Node::K::Param, P); p->s1 = pn; p->s2 = A.str(ptype); params.push_back(p);
                 if (eat(Tok::Comma)) continue; else break;
             }
         }
@@ -354,14 +664,14 @@ struct Parser {
         string rettype;
         if (eat(Tok::Colon)) rettype = readType();
         auto body = parseBlock();
-        auto f = N(kind, L, C); f->s1 = name; f->s2 = rettype; f->xs = params; f->xs.push_back(body);
+        auto f = N(kind, P); f->s1 = name; f->s2 = A.str(rettype); params.push_back(body); f->xs = list_of(A, params);
         return f;
     }
 
     string readType() {
         // Simple type reader: accepts identifiers and generic capsule<...>, byte[N]
         string out;
-        if (is(Tok::Ident)) { out = t.lex; adv(); }
+        if (is(Tok::Ident)) { out = string(t.lex); adv(); }
         else perr("expected type ident");
         if (eat(Tok::Lt)) { // generics
             out.push_back('<');
@@ -376,34 +686,36 @@ struct Parser {
         return out;
     }
 
-    shared_ptr<Node> parseBlock() {
+    Node* parseBlock() {
         expect(Tok::LBrace, "{");
-        auto b = N(Node::K::Block, t.line, t.col);
+        auto b = N(Node::K::Block, t.pos);
+        vector<Node*> xs;
         while (!is(Tok::RBrace)) {
-            b->xs.push_back(parseStmt());
+            xs.push_back(parseStmt());
         }
         adv(); // consume }
+        b->xs = list_of(A, xs);
         return b;
     }
 
-    shared_ptr<Node> parseLet() {
-        auto L = t.line, C = t.col; adv(); // let
+    Node* parseLet() {
+        auto P = t.pos; adv(); // let
         if (!is(Tok::Ident)) perr("expected $name");
-        string name = t.lex; adv();
+        string_view name = t.lex; adv();
         expect(Tok::Colon, ":");
         string typ = readType();
         // optional init = expr
-        shared_ptr<Node> init;
+        Node* init = nullptr;
         if (eat(Tok::Assign)) init = parseExpr();
         expect(Tok::Semi, ";");
-        auto n = N(Node::K::Let, L, C); n->s1 = name; n->s2 = typ; if (init) n->xs.push_back(init); return n;
+        auto n = N(Node::K::Let, P); n->s1 = name; n->s2 = A.str(typ); if (init) n->xs = list_of(A, { init }); return n;
     }
 
-    shared_ptr<Node> parseStmt() {
+    Node* parseStmt() {
         // labels
-        if (is(Tok::Label)) { auto n = N(Node::K::Label, t.line, t.col); n->s1 = t.lex; adv(); return n; }
+        if (is(Tok::Label)) { auto n = N(Node::K::Label, t.pos); n->s1 = t.lex; adv(); return n; }
         // goto
-        if (is(Tok::Goto)) { auto L = t.line, C = t.col; adv(); if (!is(Tok::Label)) perr("expected :label"); auto n = N(Node::K::Goto, L, C); n->s1 = t.lex; adv(); expect(Tok::Semi, ";"); return n; }
+        if (is(Tok::Goto)) { auto P = t.pos; adv(); if (!is(Tok::Label)) perr("expected :label"); auto n = N(Node::K::Goto, P); n->s1 = t.lex; adv(); expect(Tok::Semi, ";"); return n; }
 
         // shortcode ops and long-form control
         switch (t.kind) {
@@ -413,7 +725,7 @@ struct Parser {
         case Tok::HashRelease:return parseOp1(Node::K::Release);
         case Tok::HashLoad:   return parseLoad();
         case Tok::HashCall:   return parseCall();
-        case Tok::HashExit: { auto n = N(Node::K::Exit, t.line, t.col); adv(); return n; }
+        case Tok::HashExit: { auto n = N(Node::K::Exit, t.pos); adv(); return n; }
         case Tok::HashRender: return parseOp1(Node::K::Render);
         case Tok::HashInput:  return parseOp1(Node::K::Input);
         case Tok::HashOutput: return parseOp1(Node::K::Output);
@@ -424,7 +736,7 @@ struct Parser {
         case Tok::HashStamp:  return parseStamp();
         case Tok::HashExpire: return parseExpire();
         case Tok::HashSleep:  return parseSleep();
-        case Tok::HashYield: { auto n = N(Node::K::Yield, t.line, t.col); adv(); return n; }
+        case Tok::HashYield: { auto n = N(Node::K::Yield, t.pos); adv(); return n; }
         case Tok::HashError:  return parseError();
 
         case Tok::HashIf:     return parseIfHash();
@@ -434,30 +746,30 @@ struct Parser {
         case Tok::Loop:       return parseLoopLong();
 
         case Tok::Let:        return parseLet();
-        case Tok::Return: { auto L = t.line, C = t.col; adv(); shared_ptr<Node> e; if (!is(Tok::Semi)) e = parseExpr(); expect(Tok::Semi, ";"); auto n = N(Node::K::Return, L, C); if (e)n->xs.push_back(e); return n; }
-        case Tok::Print: { auto L = t.line, C = t.col; adv(); vector<shared_ptr<Node>> vs; vs.push_back(parseExpr()); while (eat(Tok::Comma)) vs.push_back(parseExpr()); expect(Tok::Semi, ";"); auto n = N(Node::K::Print, L, C); n->xs = move(vs); return n; }
+        case Tok::Return: { auto P = t.pos; adv(); Node* e = nullptr; if (!is(Tok::Semi)) e = parseExpr(); expect(Tok::Semi, ";"); auto n = N(Node::K::Return, P); if (e) n->xs = list_of(A, { e }); return n; }
+        case Tok::Print: { auto P = t.pos; adv(); vector<Node*> vs; vs.push_back(parseExpr()); while (eat(Tok::Comma)) vs.push_back(parseExpr()); expect(Tok::Semi, ";"); auto n = N(Node::K::Print, P); n->xs = list_of(A, vs); return n; }
         default: break;
         }
 
         // long-form synonyms
         if (is(Tok::Initialize)) { auto n = parseOp1(Node::K::Init, /*longForm*/true); return n; }
         if (is(Tok::AssignValue)) { // "assign value <expr> to capsule $A0"
-            auto L = t.line, C = t.col; adv(); // assign
+            auto P = t.pos; adv(); // assign
             if (!is(Tok::Ident) || t.lex != "value") perr("expected 'value'");
             adv(); auto val = parseExpr();
             if (!is(Tok::Ident) || t.lex != "to") perr("expected 'to'"); adv();
-            if (!is(Tok::Ident)) perr("expected capsule name"); string cap = t.lex; adv();
-            auto n = N(Node::K::Load, L, C); n->s1 = cap; n->xs = { val }; return n;
+            if (!is(Tok::Ident)) perr("expected capsule name"); string_view cap = t.lex; adv();
+            auto n = N(Node::K::Load, P); n->s1 = cap; n->xs = list_of(A, { val }); return n;
         }
         if (is(Tok::InvokeFunction)) { // "invoke function $f with capsule $A0"
-            auto L = t.line, C = t.col; adv();
+            auto P = t.pos; adv();
             if (!is(Tok::Ident) || t.lex != "function") perr("expected 'function'"); adv();
-            if (!is(Tok::Ident)) perr("expected function name"); string fn = t.lex; adv();
+            if (!is(Tok::Ident)) perr("expected function name"); string_view fn = t.lex; adv();
             if (!is(Tok::Ident) || t.lex != "with") perr("expected 'with'"); adv();
             auto arg = parseExpr();
-            auto n = N(Node::K::Call, t.line, t.col); n->s1 = fn; n->xs = { arg }; return n;
+            auto n = N(Node::K::Call, t.pos); n->s1 = fn; n->xs = list_of(A, { arg }); return n;
         }
-        if (is(Tok::TerminateExecution)) { auto n = N(Node::K::Exit, t.line, t.col); adv(); return n; }
+        if (is(Tok::TerminateExecution)) { auto n = N(Node::K::Exit, t.pos); adv(); return n; }
 
         // block
         if (is(Tok::LBrace)) return parseBlock();
@@ -468,115 +780,115 @@ struct Parser {
         return e; // expression-as-statement (e.g., bare calls)
     }
 
-    shared_ptr<Node> parseOp1(Node::K kind, bool longForm = false) {
-        auto L = t.line, C = t.col; adv();
+    Node* parseOp1(Node::K kind, bool longForm = false) {
+        auto P = t.pos; adv();
         // expect an identifier (capsule) for most ops
         if (!is(Tok::Ident)) perr("expected $capsule");
-        string a = t.lex; adv();
-        auto n = N(kind, L, C); n->s1 = a; return n;
+        string_view a = t.lex; adv();
+        auto n = N(kind, P); n->s1 = a; return n;
     }
-    shared_ptr<Node> parseOp2(Node::K kind) {
-        auto L = t.line, C = t.col; adv();
-        if (!is(Tok::Ident)) perr("expected first capsule"); string a = t.lex; adv();
-        expect(Tok::Comma, ","); if (!is(Tok::Ident)) perr("expected second capsule"); string b = t.lex; adv();
-        auto n = N(kind, L, C); n->s1 = a; n->s2 = b; return n;
+    Node* parseOp2(Node::K kind) {
+        auto P = t.pos; adv();
+        if (!is(Tok::Ident)) perr("expected first capsule"); string_view a = t.lex; adv();
+        expect(Tok::Comma, ","); if (!is(Tok::Ident)) perr("expected second capsule"); string_view b = t.lex; adv();
+        auto n = N(kind, P); n->s1 = a; n->s2 = b; return n;
     }
-    shared_ptr<Node> parseLoad() {
-        auto L = t.line, C = t.col; adv(); if (!is(Tok::Ident)) perr("expected $capsule"); string cap = t.lex; adv();
+    Node* parseLoad() {
+        auto P = t.pos; adv(); if (!is(Tok::Ident)) perr("expected $capsule"); string_view cap = t.lex; adv();
         expect(Tok::Comma, ",");
         auto val = parseExpr();
-        auto n = N(Node::K::Load, L, C); n->s1 = cap; n->xs = { val }; return n;
+        auto n = N(Node::K::Load, P); n->s1 = cap; n->xs = list_of(A, { val }); return n;
     }
-    shared_ptr<Node> parseCall() {
-        auto L = t.line, C = t.col; adv(); if (!is(Tok::Ident)) perr("expected function name"); string fn = t.lex; adv();
-        expect(Tok::Comma, ","); auto arg = parseExpr(); auto n = N(Node::K::Call, L, C); n->s1 = fn; n->xs = { arg }; return n;
+    Node* parseCall() {
+        auto P = t.pos; adv(); if (!is(Tok::Ident)) perr("expected function name"); string_view fn = t.lex; adv();
+        expect(Tok::Comma, ","); auto arg = parseExpr(); auto n = N(Node::K::Call, P); n->s1 = fn; n->xs = list_of(A, { arg }); return n;
     }
-    shared_ptr<Node> parseSpawn() {
-        auto L = t.line, C = t.col; adv(); if (!is(Tok::Ident)) perr("expected worker name"); string wk = t.lex; adv();
-        vector<shared_ptr<Node>> args; if (eat(Tok::Comma)) { args.push_back(parseExpr()); while (eat(Tok::Comma)) args.push_back(parseExpr()); }
-        auto n = N(Node::K::Spawn, L, C); n->s1 = wk; n->xs = move(args); return n;
+    Node* parseSpawn() {
+        auto P = t.pos; adv(); if (!is(Tok::Ident)) perr("expected worker name"); string_view wk = t.lex; adv();
+        vector<Node*> args; if (eat(Tok::Comma)) { args.push_back(parseExpr()); while (eat(Tok::Comma)) args.push_back(parseExpr()); }
+        auto n = N(Node::K::Spawn, P); n->s1 = wk; n->xs = list_of(A, args); return n;
     }
-    shared_ptr<Node> parseStamp() {
-        auto L = t.line, C = t.col; adv(); if (!is(Tok::Ident)) perr("expected $capsule"); string cap = t.lex; adv();
+    Node* parseStamp() {
+        auto P = t.pos; adv(); if (!is(Tok::Ident)) perr("expected $capsule"); string_view cap = t.lex; adv();
         expect(Tok::Comma, ",");
         if (!(is(Tok::Bool) || is(Tok::Number))) perr("expected bool or number stamp");
-        auto n = N(Node::K::Stamp, L, C); n->s1 = cap;
+        auto n = N(Node::K::Stamp, P); n->s1 = cap;
         if (is(Tok::Bool)) { n->b = t.bval; adv(); }
         else { n->i64 = t.ival; adv(); }
         return n;
     }
-    shared_ptr<Node> parseExpire() {
-        auto L = t.line, C = t.col; adv(); if (!is(Tok::Ident)) perr("expected $capsule"); string cap = t.lex; adv();
+    Node* parseExpire() {
+        auto P = t.pos; adv(); if (!is(Tok::Ident)) perr("expected $capsule"); string_view cap = t.lex; adv();
         expect(Tok::Comma, ","); if (!is(Tok::Duration)) perr("expected duration literal (e.g., 5ms)");
-        auto n = N(Node::K::Expire, L, C); n->s1 = cap; n->du_ns = t.du_ns; adv(); return n;
+        auto n = N(Node::K::Expire, P); n->s1 = cap; n->du_ns = t.du_ns; adv(); return n;
     }
-    shared_ptr<Node> parseSleep() {
-        auto L = t.line, C = t.col; adv(); if (!is(Tok::Duration)) perr("expected duration"); auto n = N(Node::K::Sleep, L, C); n->du_ns = t.du_ns; adv(); return n;
+    Node* parseSleep() {
+        auto P = t.pos; adv(); if (!is(Tok::Duration)) perr("expected duration"); auto n = N(Node::K::Sleep, P); n->du_ns = t.du_ns; adv(); return n;
     }
-    shared_ptr<Node> parseError() {
-        auto L = t.line, C = t.col; adv();
-        if (!is(Tok::Ident)) perr("expected $capsule"); string cap = t.lex; adv();
+    Node* parseError() {
+        auto P = t.pos; adv();
+        if (!is(Tok::Ident)) perr("expected $capsule"); string_view cap = t.lex; adv();
         expect(Tok::Comma, ","); if (!is(Tok::Number)) perr("expected code"); long long code = t.ival; adv();
-        expect(Tok::Comma, ","); if (!is(Tok::String)) perr("expected message"); string msg = t.lex; adv();
-        auto n = N(Node::K::Error, L, C); n->s1 = cap; n->i64 = code; n->s2 = msg; return n;
+        expect(Tok::Comma, ","); if (!is(Tok::String)) perr("expected message"); string_view msg = t.lex; adv();
+        auto n = N(Node::K::Error, P); n->s1 = cap; n->i64 = code; n->s2 = msg; return n;
     }
 
-    shared_ptr<Node> parseIfHash() {
-        auto L = t.line, C = t.col; adv(); expect(Tok::LParen, "("); auto cond = parseExpr(); expect(Tok::RParen, ")");
-        auto thenBlk = parseBlock(); shared_ptr<Node> elseBlk;
+    Node* parseIfHash() {
+        auto P = t.pos; adv(); expect(Tok::LParen, "("); auto cond = parseExpr(); expect(Tok::RParen, ")");
+        auto thenBlk = parseBlock(); Node* elseBlk = nullptr;
         if (eat(Tok::HashElse)) { elseBlk = parseBlock(); }
         if (!eat(Tok::HashEndIf)) perr("expected #endif");
-        auto n = N(Node::K::If, L, C); n->xs = { cond,thenBlk }; if (elseBlk) n->xs.push_back(elseBlk); return n;
+        auto n = N(Node::K::If, P); n->xs = elseBlk ? list_of(A, { cond,thenBlk,elseBlk }) : list_of(A, { cond,thenBlk }); return n;
     }
-    shared_ptr<Node> parseIfLong() {
-        auto L = t.line, C = t.col; adv(); expect(Tok::LParen, "("); auto cond = parseExpr(); expect(Tok::RParen, ")");
-        auto thenBlk = parseBlock(); shared_ptr<Node> elseBlk; if (eat(Tok::Else)) elseBlk = parseBlock();
-        auto n = N(Node::K::If, L, C); n->xs = { cond,thenBlk }; if (elseBlk) n->xs.push_back(elseBlk); return n;
+    Node* parseIfLong() {
+        auto P = t.pos; adv(); expect(Tok::LParen, "("); auto cond = parseExpr(); expect(Tok::RParen, ")");
+        auto thenBlk = parseBlock(); Node* elseBlk = nullptr; if (eat(Tok::Else)) elseBlk = parseBlock();
+        auto n = N(Node::K::If, P); n->xs = elseBlk ? list_of(A, { cond,thenBlk,elseBlk }) : list_of(A, { cond,thenBlk }); return n;
     }
-    shared_ptr<Node> parseLoopHash() {
-        auto L = t.line, C = t.col; adv(); expect(Tok::LParen, "("); auto cond = parseExpr(); expect(Tok::RParen, ")");
-        auto body = parseBlock(); auto n = N(Node::K::Loop, L, C); n->xs = { cond,body }; return n;
+    Node* parseLoopHash() {
+        auto P = t.pos; adv(); expect(Tok::LParen, "("); auto cond = parseExpr(); expect(Tok::RParen, ")");
+        auto body = parseBlock(); auto n = N(Node::K::Loop, P); n->xs = list_of(A, { cond,body }); return n;
     }
-    shared_ptr<Node> parseLoopLong() {
-        auto L = t.line, C = t.col; adv(); expect(Tok::LParen, "("); auto cond = parseExpr(); expect(Tok::RParen, ")");
-        auto body = parseBlock(); auto n = N(Node::K::Loop, L, C); n->xs = { cond,body }; return n;
+    Node* parseLoopLong() {
+        auto P = t.pos; adv(); expect(Tok::LParen, "("); auto cond = parseExpr(); expect(Tok::RParen, ")");
+        auto body = parseBlock(); auto n = N(Node::K::Loop, P); n->xs = list_of(A, { cond,body }); return n;
     }
 
     // Expressions (Pratt)
-    shared_ptr<Node> parseExpr() { return parseBin(0, parseUnary()); }
-    shared_ptr<Node> parseUnary() {
+    Node* parseExpr() { return parseBin(0, parseUnary()); }
+    Node* parseUnary() {
         if (is(Tok::Bang) || is(Tok::Minus) || is(Tok::Tilde)) {
-            auto op = t; adv(); auto rhs = parseUnary(); auto n = N(Node::K::Un, op.line, op.col); n->s1 = op.lex; n->xs = { rhs }; return n;
+            auto op = t; adv(); auto rhs = parseUnary(); auto n = N(Node::K::Un, op.pos); n->s1 = op.lex; n->xs = list_of(A, { rhs }); return n;
         }
         return parsePrimary();
     }
-    shared_ptr<Node> parsePrimary() {
-        if (is(Tok::Number)) { auto n = N(Node::K::ConstI, t.line, t.col); n->i64 = t.ival; adv(); return n; }
-        if (is(Tok::String)) { auto n = N(Node::K::ConstStr, t.line, t.col); n->s1 = t.lex; adv(); return n; }
-        if (is(Tok::Bool)) { auto n = N(Node::K::ConstBool, t.line, t.col); n->b = t.bval; adv(); return n; }
+    Node* parsePrimary() {
+        if (is(Tok::Number)) { auto n = N(Node::K::ConstI, t.pos); n->i64 = t.ival; adv(); return n; }
+        if (is(Tok::String)) { auto n = N(Node::K::ConstStr, t.pos); n->s1 = t.lex; adv(); return n; }
+        if (is(Tok::Bool)) { auto n = N(Node::K::ConstBool, t.pos); n->b = t.bval; adv(); return n; }
         if (is(Tok::Ident)) {
-            string id = t.lex; adv();
+            string_view id = t.lex; adv();
             // call expression: id '(' args ')'
             if (eat(Tok::LParen)) {
-                vector<shared_ptr<Node>> args;
+                vector<Node*> args;
                 if (!is(Tok::RParen)) { args.push_back(parseExpr()); while (eat(Tok::Comma)) args.push_back(parseExpr()); }
                 expect(Tok::RParen, ")");
-                auto n = N(Node::K::CallExpr, t.line, t.col); n->s1 = id; n->xs = move(args); return n;
+                auto n = N(Node::K::CallExpr, t.pos); n->s1 = id; n->xs = list_of(A, args); return n;
             }
-            auto n = N(Node::K::Var, t.line, t.col); n->s1 = id; return n;
+            auto n = N(Node::K::Var, t.pos); n->s1 = id; return n;
         }
         if (eat(Tok::LParen)) { auto e = parseExpr(); expect(Tok::RParen, ")"); return e; }
         perr("unexpected expression");
     }
-    shared_ptr<Node> parseBin(int minPrec, shared_ptr<Node> lhs) {
+    Node* parseBin(int minPrec, Node* lhs) {
         for (;;) {
             int p = prec();
-            if (p < minPrec) return lhs;
+            if (p == 0 || p < minPrec) return lhs;
             Token op = t; adv();
             auto rhs = parseUnary();
             int p2 = prec();
             if (p < p2) rhs = parseBin(p + 1, rhs);
-            auto n = N(Node::K::Bin, op.line, op.col); n->s1 = op.lex; n->xs = { lhs,rhs }; lhs = n;
+            auto n = N(Node::K::Bin, op.pos); n->s1 = op.lex; n->xs = list_of(A, { lhs,rhs }); lhs = n;
         }
     }
 };
@@ -584,40 +896,103 @@ struct Parser {
 //
 // Star-Code Validation (representative checks)
 //
-struct Diagnostic { string kind; string msg; int line = 0, col = 0; };
+struct Diagnostic { string kind; string msg; uint32_t pos = 0; };
+struct StarCode;
+// One Star-Code check: the node kinds it looks at (a bit per Node::K) and an optional step after the walk.
+struct StarRule {
+    const char* name; uint64_t kinds;
+    void (*visit)(StarCode&, const Node*); void (*finish)(StarCode&);
+};
+static constexpr uint64_t kind_bit(Node::K k) { return 1ULL << (unsigned)k; }
+static constexpr size_t kNodeKinds = (size_t)Node::K::ConstBool + 1;
+static_assert(kNodeKinds <= 64, "StarRule::kinds holds one bit per node kind");
+
+// Runs the enabled rules (--star-rules) in a single walk over the AST, dispatching each node to the rules
+// registered for its kind. Diagnostics are grouped by rule in table order, each group in walk order.
 struct StarCode {
+    static constexpr size_t kMaxRules = 32;
     vector<Diagnostic> diags;
-    void warn(int L, int C, const string& m) { diags.push_back({ "warning",m,L,C }); }
-    void err(int L, int C, const string& m) { diags.push_back({ "error",m,L,C }); }
-
-    void run(const shared_ptr<Node>& prog) {
-        // Undefined labels / goto targets; non-bool if/loop cond (here, we only detect literal non-bools)
-        unordered_set<string> labels;
-        vector<pair<int, pair<int, string>>> gotos; // line/col,label
-        function<void(const shared_ptr<Node>&)> walk = [&](const shared_ptr<Node>& n) {
-            if (!n) return;
-            if (n->k == Node::K::Label) labels.insert(n->s1);
-            if (n->k == Node::K::Goto) gotos.push_back({ n->line,{n->col,n->s1} });
-            if (n->k == Node::K::If || n->k == Node::K::Loop) {
-                auto cond = n->xs[0];
-                if (cond->k == Node::K::ConstI || cond->k == Node::K::ConstStr) warn(cond->line, cond->col, "non-bool literal used as condition");
-            }
-            for (auto& c : n->xs) walk(c);
-            };
-        walk(prog);
-        for (auto& g : gotos) {
-            if (!labels.count(g.second.second)) err(g.first, g.second.first, "goto to undefined label: " + g.second.second);
-        }
-        // duration sanity
-        function<void(const shared_ptr<Node>&)> checkDur = [&](const shared_ptr<Node>& n) {
-            if (n->k == Node::K::Expire || n->k == Node::K::Sleep) {
-                if (n->du_ns > (unsigned long long)9e18) warn(n->line, n->col, "duration too large");
-            }
-            for (auto& c : n->xs) checkDur(c);
-            };
-        checkDur(prog);
+    uint32_t enabled; // bit per kStarRules entry
+    explicit StarCode(uint32_t rules = ~0u) : enabled(rules) {}
+
+    // "labels" state: names interned to dense ids (views into the AST), defined flag per id, gotos by id.
+    unordered_map<string_view, uint32_t> labelIds; vector<string_view> labelNames; vector<uint8_t> labelDefined;
+    vector<pair<uint32_t, uint32_t>> gotos; // pos, label id
+    uint32_t labelId(string_view name) {
+        auto [it, fresh] = labelIds.emplace(name, (uint32_t)labelNames.size());
+        if (fresh) { labelNames.push_back(name); labelDefined.push_back(0); }
+        return it->second;
     }
+
+    void warn(uint32_t P, const string& m) { found[cur].push_back({ "warning",m,P }); }
+    void err(uint32_t P, const string& m) { found[cur].push_back({ "error",m,P }); }
+
+    void run(const Node* prog);
+    static uint32_t parseRules(const string& spec);
+
+private:
+    vector<Diagnostic> found[kMaxRules]; size_t cur = 0;
+    vector<uint8_t> byKind[kNodeKinds]; // enabled rules (kStarRules indices) per node kind
+    void walk(const Node* n);
+};
+
+static void rule_cond_literal(StarCode& sc, const Node* n) { // non-bool if/loop condition (literal constants only)
+    if (n->xs.empty()) return;
+    const Node* cond = n->xs[0];
+    if (cond->k == Node::K::ConstI || cond->k == Node::K::ConstStr) sc.warn(cond->pos, "non-bool literal used as condition");
+}
+static void rule_labels_visit(StarCode& sc, const Node* n) {
+    uint32_t id = sc.labelId(n->s1);
+    if (n->k == Node::K::Label) sc.labelDefined[id] = 1; else sc.gotos.push_back({ n->pos, id });
+}
+static void rule_labels_finish(StarCode& sc) { // undefined goto targets, anywhere in the module
+    for (auto& g : sc.gotos) if (!sc.labelDefined[g.second]) sc.err(g.first, "goto to undefined label: " + string(sc.labelNames[g.second]));
+}
+static void rule_durations(StarCode& sc, const Node* n) {
+    if (n->du_ns > (unsigned long long)9e18) sc.warn(n->pos, "duration too large");
+}
+
+static const StarRule kStarRules[] = {
+    { "cond-literal", kind_bit(Node::K::If) | kind_bit(Node::K::Loop), rule_cond_literal, nullptr },
+    { "labels", kind_bit(Node::K::Label) | kind_bit(Node::K::Goto), rule_labels_visit, rule_labels_finish },
+    { "durations", kind_bit(Node::K::Expire) | kind_bit(Node::K::Sleep), rule_durations, nullptr },
 };
+static constexpr size_t kNumStarRules = sizeof kStarRules / sizeof kStarRules[0];
+static_assert(kNumStarRules <= StarCode::kMaxRules, "rule bits and buffers");
+
+void StarCode::walk(const Node* n) {
+    if (!n) return;
+    for (uint8_t r : byKind[(size_t)n->k]) { cur = r; kStarRules[r].visit(*this, n); }
+    for (auto& c : n->xs) walk(c);
+}
+
+void StarCode::run(const Node* prog) {
+    for (size_t r = 0; r < kNumStarRules; r++) {
+        if (!(enabled >> r & 1)) continue;
+        for (size_t k = 0; k < kNodeKinds; k++) if (kStarRules[r].kinds >> k & 1) byKind[k].push_back((uint8_t)r);
+    }
+    walk(prog);
+    for (size_t r = 0; r < kNumStarRules; r++) if ((enabled >> r & 1) && kStarRules[r].finish) { cur = r; kStarRules[r].finish(*this); }
+    for (size_t r = 0; r < kNumStarRules; r++) { for (auto& d : found[r]) diags.push_back(move(d)); found[r].clear(); }
+}
+
+// "all", "none", or a comma list of rule names: plain names select just those, "-name" drops one from all.
+uint32_t StarCode::parseRules(const string& spec) {
+    if (spec == "all") return ~0u;
+    if (spec == "none") return 0;
+    uint32_t on = 0, off = 0; bool only = false;
+    for (size_t b = 0; b <= spec.size();) {
+        size_t e = spec.find(',', b); if (e == string::npos) e = spec.size();
+        string name = spec.substr(b, e - b); bool drop = !name.empty() && name[0] == '-'; if (drop) name.erase(0, 1);
+        size_t r = 0; while (r < kNumStarRules && name != kStarRules[r].name) r++;
+        if (r == kNumStarRules) {
+            string all; for (auto& x : kStarRules) all += string(all.empty() ? "" : ", ") + x.name;
+            throw runtime_error("unknown star rule: " + name + " (rules: " + all + ")");
+        }
+        (drop ? off : on) |= 1u << r; only |= !drop; b = e + 1;
+    }
+    return (only ? on : ~0u) & ~off;
+}
 
 //
 // IR (hex opcodes) and Emitter
@@ -627,25 +1002,347 @@ enum Op : uint8_t {
     OP_LOAD = 0x05, OP_CALL = 0x06, OP_EXIT = 0x07,
     OP_RENDER = 0x08, OP_INPUT = 0x09, OP_OUTPUT = 0x0A,
     OP_SEND = 0x0B, OP_RECV = 0x0C, OP_SPAWN = 0x0D, OP_JOIN = 0x0E,
-    OP_STAMP = 0x0F, OP_EXPIRE = 0x10, OP_SLEEP = 0x11, OP_YIELD = 0x12, OP_ERROR = 0x13,
+    OP_STAMP = 0x0F, OP_EXPIRE = 0x10, OP_SLEEP = 0x11, OP_YIELD = 0x12, OP_ERROR = 0x13, // EXPIRE c, lo, hi / SLEEP lo, hi: 64-bit ns
 
     OP_PUSHK = 0x20, OP_PUSHCAP = 0x21, OP_UN = 0x22, OP_BIN = 0x23,
     OP_JZ = 0x30, OP_JNZ = 0x31, OP_JMP = 0x32,
 
+    // Superinstructions for the most frequent sequences in compiled programs
+    OP_PUSHCAP2 = 0x24, // a, b      PUSHCAP a; PUSHCAP b
+    OP_LOAD_K = 0x25,   // c, k      PUSHK k; LOAD c
+    OP_INCCAP = 0x26,   // c, k      PUSHCAP c; PUSHK k; BIN +; LOAD c
+    // c, k, t: PUSHCAP c; PUSHK k; BIN <cmp>; JZ t, i.e. jump to t unless c <cmp> k (same order as BinOp EQ..GE)
+    OP_CMPJEQ = 0x38, OP_CMPJNE = 0x39, OP_CMPJLT = 0x3A, OP_CMPJGT = 0x3B, OP_CMPJLE = 0x3C, OP_CMPJGE = 0x3D,
+
+    // Three-address forms (--regs): capsule to capsule, the BinOp byte after the 32-bit fields
+    OP_MOVCAP = 0x27, // d, a        PUSHCAP a; LOAD d
+    OP_BINCAP = 0x28, // d, a, b, op PUSHCAP a; PUSHCAP b; BIN op; LOAD d
+    OP_BINK = 0x29,   // d, a, k, op PUSHCAP a; PUSHK k; BIN op; LOAD d
+
     OP_END = 0xFF
 };
+// Encoded size (opcode + operands) in bytes; 0 for an unknown opcode.
+static inline size_t op_len(uint8_t op) {
+    switch (op) {
+    case OP_EXIT: case OP_YIELD: case OP_END: return 1;
+    case OP_UN: case OP_BIN: return 2;
+    case OP_SPAWN: return 6;
+    case OP_SEND: case OP_RECV: case OP_STAMP: case OP_SLEEP: case OP_PUSHCAP2: case OP_LOAD_K: case OP_INCCAP: case OP_MOVCAP: return 9;
+    case OP_BINCAP: case OP_BINK: return 14;
+    case OP_EXPIRE: case OP_ERROR: case OP_CMPJEQ: case OP_CMPJNE: case OP_CMPJLT: case OP_CMPJGT: case OP_CMPJLE: case OP_CMPJGE: return 13;
+    case OP_INIT: case OP_LEASE: case OP_SUBLEASE: case OP_RELEASE: case OP_LOAD: case OP_CALL:
+    case OP_RENDER: case OP_INPUT: case OP_OUTPUT: case OP_JOIN:
+    case OP_PUSHK: case OP_PUSHCAP: case OP_JZ: case OP_JNZ: case OP_JMP: return 5;
+    default: return 0;
+    }
+}
+// 32-bit fields of a wide instruction (after the opcode; a UN/BIN/BINCAP/BINK operator or SPAWN's argc byte follows them)
+static inline size_t op_fields(uint8_t op) { return op == OP_UN || op == OP_BIN ? 0 : (op_len(op) - 1) / 4; }
+// Leading 32-bit operands that are capsule ids (the object image relocates them per module).
+static inline int op_caps(uint8_t op) {
+    switch (op) {
+    case OP_BINCAP: return 3;
+    case OP_SEND: case OP_RECV: case OP_PUSHCAP2: case OP_MOVCAP: case OP_BINK: return 2;
+    case OP_INIT: case OP_LEASE: case OP_SUBLEASE: case OP_RELEASE: case OP_LOAD: case OP_RENDER: case OP_INPUT:
+    case OP_OUTPUT: case OP_JOIN: case OP_PUSHCAP: case OP_STAMP: case OP_EXPIRE: case OP_ERROR: case OP_LOAD_K: case OP_INCCAP:
+    case OP_CMPJEQ: case OP_CMPJNE: case OP_CMPJLT: case OP_CMPJGT: case OP_CMPJLE: case OP_CMPJGE: return 1;
+    default: return 0;
+    }
+}
+static inline bool op_is_cmpj(uint8_t op) { return op >= OP_CMPJEQ && op <= OP_CMPJGE; }
+// Index of the capsule field whose value or state the instruction changes; -1 when it only reads capsules.
+static inline int op_cap_written(uint8_t op) {
+    switch (op) {
+    case OP_SEND: case OP_RECV: return 1; // the packet: moved out / replaced (field 0 is the channel)
+    case OP_INIT: case OP_LEASE: case OP_SUBLEASE: case OP_RELEASE: case OP_LOAD: case OP_INPUT: case OP_STAMP: case OP_EXPIRE:
+    case OP_ERROR: case OP_LOAD_K: case OP_INCCAP: case OP_MOVCAP: case OP_BINCAP: case OP_BINK: return 0;
+    default: return -1;
+    }
+}
+// Byte offset of the operand holding a TEXT address (branch, call or spawn target); 0 when there is none.
+static inline size_t op_target(uint8_t op) {
+    switch (op) {
+    case OP_JZ: case OP_JNZ: case OP_JMP: case OP_CALL: case OP_SPAWN: return 1;
+    default: return op_is_cmpj(op) ? 9 : 0;
+    }
+}
+// Branches that either jump or fall through.
+static inline bool op_cond_branch(uint8_t op) { return op == OP_JZ || op == OP_JNZ || op_is_cmpj(op); }
 enum BinOp : uint8_t {
     B_OR = 1, B_AND = 2, B_EQ = 3, B_NE = 4, B_LT = 5, B_GT = 6, B_LE = 7, B_GE = 8, B_ADD = 9, B_SUB = 10, B_MUL = 11, B_DIV = 12, B_MOD = 13
 };
-static inline uint8_t op_of(const string& s) {
+static inline bool is_cmp(uint8_t b) { return b >= B_EQ && b <= B_GE; }
+static inline uint8_t cmpj_of(uint8_t cmp) { return (uint8_t)(OP_CMPJEQ + (cmp - B_EQ)); }
+static inline uint8_t cmp_of_cmpj(uint8_t op) { return (uint8_t)(B_EQ + (op - OP_CMPJEQ)); }
+static inline uint8_t cmp_negate(uint8_t b) { // !(a op b) == a negate(op) b
+    switch (b) { case B_EQ: return B_NE; case B_NE: return B_EQ; case B_LT: return B_GE; case B_GE: return B_LT; case B_GT: return B_LE; default: return B_GT; }
+}
+static inline bool eval_cmp(uint8_t b, long long a, long long c) {
+    switch (b) { case B_EQ: return a == c; case B_NE: return a != c; case B_LT: return a < c; case B_GT: return a > c; case B_LE: return a <= c; default: return a >= c; }
+}
+static inline uint8_t op_of(string_view s) {
     if (s == "||") return B_OR; if (s == "&&") return B_AND; if (s == "==") return B_EQ; if (s == "!=") return B_NE;
     if (s == "<")return B_LT; if (s == ">")return B_GT; if (s == "<=")return B_LE; if (s == ">=")return B_GE;
     if (s == "+")return B_ADD; if (s == "-")return B_SUB; if (s == "*")return B_MUL; if (s == "/")return B_DIV; if (s == "%")return B_MOD;
     return 0;
 }
+static inline uint8_t un_of(string_view s) { return s == "!" ? 1 : s == "-" ? 2 : 3; } // UN operand, see eval_un
+// Shared by the VM and constant folding; false on division by zero or an unknown operator.
+static inline bool eval_bin(uint8_t op, long long a, long long b, long long& r) {
+    unsigned long long ua = (unsigned long long)a, ub = (unsigned long long)b; // wrap instead of signed-overflow UB
+    switch (op) {
+    case B_OR: r = (a || b); return true; case B_AND: r = (a && b); return true;
+    case B_EQ: r = (a == b); return true; case B_NE: r = (a != b); return true;
+    case B_LT: r = (a < b); return true; case B_GT: r = (a > b); return true;
+    case B_LE: r = (a <= b); return true; case B_GE: r = (a >= b); return true;
+    case B_ADD: r = (long long)(ua + ub); return true; case B_SUB: r = (long long)(ua - ub); return true;
+    case B_MUL: r = (long long)(ua * ub); return true;
+    case B_DIV: if (!b || (a == LLONG_MIN && b == -1)) return false; r = a / b; return true;
+    case B_MOD: if (!b || (a == LLONG_MIN && b == -1)) return false; r = a % b; return true;
+    default: return false;
+    }
+}
+// UN operand: 1 = '!', 2 = unary '-', 3 = '~' (see Emitter::emitExpr)
+static inline bool eval_un(uint8_t op, long long a, long long& r) {
+    switch (op) {
+    case 1: r = !a; return true;
+    case 2: r = (long long)(0ULL - (unsigned long long)a); return true;
+    case 3: r = ~a; return true;
+    default: return false;
+    }
+}
 
-struct Emitter {
-    vector<uint8_t> text, data, rodata;
+//
+// Symbol interner: dense per-unit ids for capsule/channel/thread operands.
+// Id 0 is reserved (OUTPUT 0 prints the value on top of the stack), so real ids start at 1.
+//
+struct Interner {
+    unordered_map<string_view, uint32_t> ids; deque<string> names{ "" }; // deque: keys view stable storage
+    uint32_t intern(string_view s) {
+        auto it = ids.find(s); if (it != ids.end()) return it->second;
+        uint32_t id = (uint32_t)names.size(); names.emplace_back(s); ids.emplace(names.back(), id); return id;
+    }
+    uint32_t find(string_view s) const { auto it = ids.find(s); return it == ids.end() ? 0u : it->second; }
+    vector<string> table() const { return vector<string>(names.begin(), names.end()); }
+};
+
+//
+// Rodata string pool: identical literals share one id; place() tail-merges the pool so a string that is a
+// suffix of another points into it ("error\0" inside "io error\0") and returns each id's rodata offset.
+//
+struct StrPool {
+    unordered_map<string_view, uint32_t> ids; deque<string> strs; // deque: keys view stable storage
+    struct Use { uint32_t pos, id; }; vector<Use> uses; // text offsets of the 32-bit rodata operands
+    size_t naiveBytes = 0; // rodata size with one copy per use site
+
+    uint32_t intern(string_view s) {
+        auto it = ids.find(s); if (it != ids.end()) return it->second;
+        uint32_t id = (uint32_t)strs.size(); strs.emplace_back(s); ids.emplace(strs.back(), id); return id;
+    }
+    void use(vector<uint8_t>& text, string_view s) { naiveBytes += s.size() + 1; uses.push_back({ (uint32_t)text.size(), intern(s) }); auto b = u32le(0xFFFFFFFFu); text.insert(text.end(), b.begin(), b.end()); }
+
+    // Sorting by reversed bytes, descending, puts every string right after a string it is a suffix of (if any).
+    // Hosts keep first-use order in the blob, so programs without repeated strings or shared tails lay out exactly as before.
+    vector<uint32_t> place(vector<uint8_t>& ro) const {
+        size_t n = strs.size(); vector<uint32_t> ord(n), host(n), off(n); ro.clear();
+        for (uint32_t i = 0; i < n; i++) ord[i] = host[i] = i;
+        sort(ord.begin(), ord.end(), [&](uint32_t a, uint32_t b) { return lexicographical_compare(strs[b].rbegin(), strs[b].rend(), strs[a].rbegin(), strs[a].rend()); });
+        for (size_t i = 1; i < n; i++) {
+            const string& p = strs[ord[i - 1]], & a = strs[ord[i]];
+            if (p.size() >= a.size() && equal(a.rbegin(), a.rend(), p.rbegin())) host[ord[i]] = host[ord[i - 1]];
+        }
+        for (uint32_t i = 0; i < n; i++) if (host[i] == i) { off[i] = (uint32_t)ro.size(); ro.insert(ro.end(), strs[i].begin(), strs[i].end()); ro.push_back(0); }
+        for (uint32_t i = 0; i < n; i++) if (host[i] != i) off[i] = off[host[i]] + (uint32_t)(strs[host[i]].size() - strs[i].size());
+        return off;
+    }
+};
+
+//
+// Build cache (--cache DIR): content-addressed files holding compiled fragments
+//   <key>.emm  a module object (header, diagnostics, linked module image)   key: tag + options + module source
+//   <key>.emu  one emitter unit before merging (text, local ids, labels)      key: tag + the unit's source span
+//   tag() names the compiler build, so a rebuilt compiler never reads an old cache. Entries are written to a
+//   temporary file and renamed into place; unreadable or truncated entries count as misses.
+//
+struct BlobW {
+    string s;
+    void u32(uint32_t v) { s.append((const char*)&v, 4); }
+    void str(string_view v) { u32((uint32_t)v.size()); s.append(v.data(), v.size()); }
+    void bytes(const vector<uint8_t>& v) { u32((uint32_t)v.size()); s.append((const char*)v.data(), v.size()); }
+    void vec32(const vector<uint32_t>& v) { u32((uint32_t)v.size()); s.append((const char*)v.data(), v.size() * 4); }
+};
+struct BlobR {
+    string_view s; size_t i = 0;
+    const char* take(size_t n) { if (n > s.size() - i) throw runtime_error("cache: truncated entry"); const char* p = s.data() + i; i += n; return p; }
+    uint32_t u32() { uint32_t v; memcpy(&v, take(4), 4); return v; }
+    string str() { uint32_t n = u32(); return string(take(n), n); }
+    vector<uint8_t> bytes() { uint32_t n = u32(); const char* p = take(n); return vector<uint8_t>(p, p + n); }
+    vector<uint32_t> vec32() { uint32_t n = u32(); vector<uint32_t> v(n); if (n) memcpy(v.data(), take((size_t)n * 4), (size_t)n * 4); return v; }
+};
+
+struct BuildCache {
+    string dir;
+    static const char* tag() { return "eminorcc-cache-1 " __DATE__ " " __TIME__; }
+
+    // 128-bit key over length-prefixed parts: two independently seeded 64-bit lanes, 8 bytes per step.
+    static string key(initializer_list<string_view> parts) {
+        uint64_t a = 0x243F6A8885A308D3ULL, b = 0x13198A2E03707344ULL;
+        auto mix = [&](uint64_t w) {
+            a = (a ^ w) * 0x9E3779B97F4A7C15ULL; a ^= a >> 29;
+            b = (b + (w ^ 0xA5A5A5A5A5A5A5A5ULL)) * 0xC2B2AE3D27D4EB4FULL; b ^= b >> 31;
+        };
+        auto add = [&](string_view v) {
+            mix(v.size()); size_t i = 0;
+            for (; i + 8 <= v.size(); i += 8) { uint64_t w; memcpy(&w, v.data() + i, 8); mix(w); }
+            uint64_t w = 0; memcpy(&w, v.data() + i, v.size() - i); mix(w ^ 0xFF);
+        };
+        add(tag()); for (auto p : parts) add(p);
+        auto fin = [](uint64_t h) { h ^= h >> 33; h *= 0xFF51AFD7ED558CCDULL; h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ULL; return h ^ (h >> 33); };
+        char buf[33]; snprintf(buf, sizeof buf, "%016llx%016llx", (unsigned long long)fin(a), (unsigned long long)fin(b ^ a));
+        return buf;
+    }
+    string path(const string& key, const char* ext) const { return (filesystem::path(dir) / (key + ext)).string(); }
+    bool load(const string& key, const char* ext, string& blob) const {
+        ifstream in(path(key, ext), ios::binary); if (!in) return false;
+        blob.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>()); return true;
+    }
+    void store(const string& key, const char* ext, const string& blob) const {
+        static atomic<unsigned> seq{ 0 };
+        string p = path(key, ext), tmp = p + ".tmp" + to_string(seq++) + "_" + to_string((unsigned long long)hash<thread::id>()(this_thread::get_id()))
+            + "_" + to_string((long long)chrono::steady_clock::now().time_since_epoch().count()); // unique across threads and processes
+        error_code ec; filesystem::create_directories(dir, ec);
+        { ofstream out(tmp, ios::binary); if (!out) return; out.write(blob.data(), (streamsize)blob.size()); if (!out) { out.close(); filesystem::remove(tmp, ec); return; } }
+        filesystem::rename(tmp, p, ec); if (ec) filesystem::remove(tmp, ec);
+    }
+};
+
+// Cached code is decoded before use: whole instructions, capsule operands inside the entry's table.
+static void check_cached_text(const vector<uint8_t>& t, size_t nCaps) {
+    for (size_t pc = 0, n; pc < t.size(); pc += n) {
+        n = op_len(t[pc]); if (!n || pc + n > t.size()) throw runtime_error("cache: bad code");
+        for (int k = 0; k < op_caps(t[pc]); k++) if (rd_u32le(&t[pc + 1 + 4 * k]) >= nCaps) throw runtime_error("cache: bad code");
+    }
+}
+
+// Runs fn(i) for i in [0, n) on up to jobs threads (0 = hardware threads); the caller's thread takes part.
+template <class F> static void parallel_for(size_t n, unsigned jobs, F fn) {
+    if (!jobs) jobs = max(1u, thread::hardware_concurrency());
+    size_t nt = min<size_t>(jobs, n); atomic<size_t> next{ 0 }; mutex errMu; exception_ptr err;
+    auto body = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < n;) {
+            try { fn(i); } catch (...) { lock_guard<mutex> g(errMu); if (!err) err = current_exception(); next = n; }
+        }
+    };
+    vector<thread> ts; for (size_t t = 1; t < nt; t++) ts.emplace_back(body);
+    body(); for (auto& t : ts) t.join();
+    if (err) rethrow_exception(err);
+}
+
+//
+// AST folding (with the optimizer on; runs per unit, right before it is emitted)
+//   Folds constant Bin/Un subtrees, turns an if/loop whose condition is constant into the branch that runs,
+//   drops the statements after return/#exit/goto and the labels no goto names. Everything happens in place:
+//   a folded node becomes a ConstI, a decided if a Block, and blocks shrink in their own arrays.
+//   A folded value must survive PUSHK (zero-extended u32); other results only fold their operands. Code holding
+//   a label some goto names is never dropped, since control can enter there.
+//
+struct AstFold {
+    const unordered_set<string_view>& gotos; // every goto target of the module
+
+    static void gotoNames(const Node* n, unordered_set<string_view>& out) {
+        if (n->k == Node::K::Goto) out.insert(n->s1);
+        for (auto& c : n->xs) gotoNames(c, out);
+    }
+    // Appends the labels under n that a goto names, which is all a fold result depends on beyond n itself.
+    static void keptLabels(const Node* n, const unordered_set<string_view>& gotos, string& out) {
+        if (n->k == Node::K::Label && gotos.count(n->s1)) { out += n->s1; out += '\n'; }
+        for (auto& c : n->xs) keptLabels(c, gotos, out);
+    }
+
+    void item(Node* n) { // a top-level function, worker or entry block
+        if (n->k == Node::K::Block) block(n); else if (!n->xs.empty()) block(n->xs.back());
+    }
+
+    static bool constOf(const Node* n, long long& v) {
+        if (n->k == Node::K::ConstI) { v = (long long)(uint32_t)n->i64; return true; } // what PUSHK gives
+        if (n->k == Node::K::ConstBool) { v = n->b; return true; }
+        return false;
+    }
+    // Folds n's subtree; true (with its value) when n is a constant.
+    bool expr(Node* n, long long& v) {
+        long long a, b;
+        switch (n->k) {
+        case Node::K::Un: if (!expr(n->xs[0], a) || !eval_un(un_of(n->s1), a, v)) return false; break;
+        case Node::K::Bin: {
+            bool ka = expr(n->xs[0], a), kb = expr(n->xs[1], b);
+            if (!ka || !kb || !eval_bin(op_of(n->s1), a, b, v)) return false; // division by zero still traps at run time
+            break;
+        }
+        case Node::K::CallExpr: for (auto& x : n->xs) expr(x, a); return false;
+        default: return constOf(n, v);
+        }
+        if (v >= 0 && v <= 0xFFFFFFFFLL) { n->k = Node::K::ConstI; n->i64 = v; n->xs = {}; }
+        return true;
+    }
+
+    bool hasLabel(const Node* n) const {
+        if (n->k == Node::K::Label && gotos.count(n->s1)) return true;
+        for (auto& c : n->xs) if (hasLabel(c)) return true;
+        return false;
+    }
+    static bool terminates(const Node* n) {
+        switch (n->k) {
+        case Node::K::Return: case Node::K::Exit: case Node::K::Goto: return true;
+        case Node::K::Block: return !n->xs.empty() && terminates(n->xs.back());
+        case Node::K::If: return n->xs.size() > 2 && terminates(n->xs[1]) && terminates(n->xs[2]);
+        default: return false;
+        }
+    }
+
+    void block(Node* b) {
+        uint32_t m = 0; bool dead = false;
+        for (Node* s : b->xs) {
+            if (s->k == Node::K::Label && !gotos.count(s->s1)) continue;
+            if (dead && !hasLabel(s)) continue;
+            dead = false; stmt(s); b->xs.p[m++] = s;
+            dead = terminates(s);
+        }
+        b->xs.n = m;
+    }
+
+    void stmt(Node* n) {
+        long long c;
+        switch (n->k) {
+        case Node::K::If: {
+            bool k = expr(n->xs[0], c);
+            for (size_t i = 1; i < n->xs.size(); i++) block(n->xs[i]);
+            if (!k) break;
+            Node* el = n->xs.size() > 2 ? n->xs[2] : nullptr, * run = c ? n->xs[1] : el, * skip = c ? el : n->xs[1];
+            if (skip && hasLabel(skip)) break;
+            n->k = Node::K::Block; n->xs = run ? run->xs : NodeList{};
+            break;
+        }
+        case Node::K::Loop: {
+            bool k = expr(n->xs[0], c); block(n->xs[1]);
+            if (k && !c && !hasLabel(n->xs[1])) { n->k = Node::K::Block; n->xs = {}; }
+            break;
+        }
+        case Node::K::Block: block(n); break;
+        case Node::K::Load: case Node::K::Call: case Node::K::Spawn: case Node::K::Print: case Node::K::Return:
+            for (auto& x : n->xs) expr(x, c);
+            break;
+        case Node::K::Bin: case Node::K::Un: case Node::K::CallExpr: expr(n, c); break;
+        default: break;
+        }
+    }
+};
+
+// Emits a run of top-level functions, workers and entry blocks into its own buffer. Capsule and string ids are
+// local to the unit and branch targets unit-relative; Emitter renumbers, resolves and concatenates the units.
+struct UnitEmitter {
+    vector<uint8_t> text, data;
+    Interner caps; // capsule, channel and thread names
+    StrPool strs;  // string literals and #error messages
     unordered_map<string, uint32_t> labels; // function/label to offset
     struct Reloc { uint32_t pos; string sym; };
     vector<Reloc> relocs;
@@ -653,24 +1350,24 @@ struct Emitter {
 
     void emit8(uint8_t b) { text.push_back(b); }
     void emit32(uint32_t v) { auto s = u32le(v); text.insert(text.end(), s.begin(), s.end()); }
+    void emit64(unsigned long long v) { emit32((uint32_t)v); emit32((uint32_t)(v >> 32)); } // low word first
 
+    void emitCap(string_view name) { emit32(caps.intern(name)); }
+    bool regs = false; // --regs: call-free expressions go capsule to capsule (see emitInto)
     void mark(const string& name) { labels[name] = (uint32_t)text.size(); }
-    void relocHere(const string& name) { relocs.push_back({ (uint32_t)text.size(),name }); emit32(0xFFFFFFFFu); }
+    void relocHere(string_view name) { relocs.push_back({ (uint32_t)text.size(),string(name) }); emit32(0xFFFFFFFFu); }
 
-    void emitExpr(const shared_ptr<Node>& n) {
+    void emitExpr(const Node* n) {
         switch (n->k) {
         case Node::K::ConstI: emit8(OP_PUSHK); emit32((uint32_t)n->i64); break;
         case Node::K::ConstBool: emit8(OP_PUSHK); emit32(n->b ? 1u : 0u); break;
-        case Node::K::ConstStr: {
-            uint32_t off = (uint32_t)rodata.size(); uint32_t len = (uint32_t)n->s1.size();
-            rodata.insert(rodata.end(), (const uint8_t*)n->s1.data(), (const uint8_t*)n->s1.data() + n->s1.size());
-            rodata.push_back(0);
-            emit8(OP_PUSHK); emit32(off); // simplistic: push rodata offset
-            break;
-        }
-        case Node::K::Var: /* capsule/ident as operand: for demo push placeholder 0 */ emit8(OP_PUSHCAP); emit32(std::hash<string>{}(n->s1)); break;
-        case Node::K::Un: emitExpr(n->xs[0]); emit8(OP_UN); emit8(n->s1 == "!" ? 1 : (n->s1 == "-" ? 2 : 3)); break;
-        case Node::K::Bin: emitExpr(n->xs[0]); emitExpr(n->xs[1]); emit8(OP_BIN); emit8(op_of(n->s1)); break;
+        case Node::K::ConstStr: emit8(OP_PUSHK); strs.use(text, n->s1); break; // pushes the rodata offset
+        case Node::K::Var: emit8(OP_PUSHCAP); emitCap(n->s1); break;
+        case Node::K::Un: emitExpr(n->xs[0]); emit8(OP_UN); emit8(un_of(n->s1)); break;
+        case Node::K::Bin:
+            if (n->xs[0]->k == Node::K::Var && n->xs[1]->k == Node::K::Var) { emit8(OP_PUSHCAP2); emitCap(n->xs[0]->s1); emitCap(n->xs[1]->s1); }
+            else { emitExpr(n->xs[0]); emitExpr(n->xs[1]); }
+            emit8(OP_BIN); emit8(op_of(n->s1)); break;
         case Node::K::CallExpr: {
             for (auto& a : n->xs) emitExpr(a);
             emit8(OP_CALL); relocHere(n->s1); break;
@@ -679,34 +1376,85 @@ struct Emitter {
         }
     }
 
-    void emitStmt(const shared_ptr<Node>& n) {
+    // Integer literals as PUSHK encodes them (zero-extended u32).
+    static bool isIntK(const Node* n) { return n->k == Node::K::ConstI || n->k == Node::K::ConstBool; }
+    static uint32_t intK(const Node* n) { return n->k == Node::K::ConstI ? (uint32_t)n->i64 : n->b ? 1u : 0u; }
+
+    void emitK(const Node* n) { if (n->k == Node::K::ConstStr) strs.use(text, n->s1); else emit32(intK(n)); }
+
+    // Register form: a tree of capsules, constants and binary operators is computed straight into its destination
+    // with MOVCAP/BINCAP/BINK/LOAD_K. Each inner operator result goes to a temporary capsule $%t<n> (n = tmp and up,
+    // so operands never share one), dead after the statement. Calls are left to the stack form: the callee runs on
+    // the same capsules and could reuse a temporary.
+    static bool regExpr(const Node* n) {
+        switch (n->k) {
+        case Node::K::Var: case Node::K::ConstI: case Node::K::ConstBool: case Node::K::ConstStr: return true;
+        case Node::K::Bin: return op_of(n->s1) && regExpr(n->xs[0]) && regExpr(n->xs[1]);
+        default: return false;
+        }
+    }
+    static string temp(unsigned i) { return "$%t" + to_string(i); }
+    static bool commutes(uint8_t op) { return op == B_ADD || op == B_MUL || op == B_EQ || op == B_NE || op == B_AND || op == B_OR; }
+    void emitInto(string_view dst, const Node* n, unsigned tmp) {
+        if (n->k == Node::K::Var) { emit8(OP_MOVCAP); emitCap(dst); emitCap(n->s1); return; }
+        if (n->k != Node::K::Bin) { emit8(OP_LOAD_K); emitCap(dst); emitK(n); return; }
+        uint8_t op = op_of(n->s1); const Node* l = n->xs[0], * r = n->xs[1];
+        if (l->k != Node::K::Var && l->k != Node::K::Bin && r->k == Node::K::Var && commutes(op)) swap(l, r); // k + $a -> $a + k
+        string tl, tr; string_view a, b;
+        if (l->k == Node::K::Var) a = l->s1; else { tl = temp(tmp++); emitInto(tl, l, tmp); a = tl; }
+        bool k = r->k != Node::K::Var && r->k != Node::K::Bin;
+        if (r->k == Node::K::Var) b = r->s1; else if (!k) { tr = temp(tmp++); emitInto(tr, r, tmp); b = tr; }
+        emit8(k ? OP_BINK : OP_BINCAP); emitCap(dst); emitCap(a); if (k) emitK(r); else emitCap(b); emit8(op);
+    }
+
+    // Evaluates cond and jumps when it is false; returns the position of the target operand to patch.
+    uint32_t emitJumpUnless(const Node* c) {
+        if (c->k == Node::K::Bin && is_cmp(op_of(c->s1)) && c->xs[0]->k == Node::K::Var && isIntK(c->xs[1])) {
+            emit8(cmpj_of(op_of(c->s1))); emitCap(c->xs[0]->s1); emit32(intK(c->xs[1]));
+        }
+        else if (regs && c->k == Node::K::Bin && regExpr(c)) {
+            if (is_cmp(op_of(c->s1)) && isIntK(c->xs[1])) { emitInto(temp(0), c->xs[0], 1); emit8(cmpj_of(op_of(c->s1))); emitCap(temp(0)); emit32(intK(c->xs[1])); }
+            else { emitInto(temp(0), c, 1); emit8(OP_CMPJNE); emitCap(temp(0)); emit32(0); } // jumps when it is 0
+        }
+        else { emitExpr(c); emit8(OP_JZ); }
+        uint32_t at = (uint32_t)text.size(); emit32(0xFFFFFFFFu); return at;
+    }
+    void emitLoad(const Node* n) {
+        const Node* v = n->xs[0];
+        if (isIntK(v)) { emit8(OP_LOAD_K); emitCap(n->s1); emit32(intK(v)); return; }
+        if (v->k == Node::K::ConstStr) { emit8(OP_LOAD_K); emitCap(n->s1); strs.use(text, v->s1); return; }
+        if (v->k == Node::K::Bin && v->s1 == "+") { // $c + k / k + $c into $c
+            const Node* a = v->xs[0], * b = v->xs[1]; if (isIntK(a)) swap(a, b);
+            if (a->k == Node::K::Var && a->s1 == n->s1 && isIntK(b)) { emit8(OP_INCCAP); emitCap(n->s1); emit32(intK(b)); return; }
+        }
+        if (regs && regExpr(v)) { emitInto(n->s1, v, 0); return; }
+        emitExpr(v); emit8(OP_LOAD); emitCap(n->s1);
+    }
+
+    void emitStmt(const Node* n) {
         switch (n->k) {
-        case Node::K::Init:    emit8(OP_INIT);    emit32(hash<string>{}(n->s1)); break;
-        case Node::K::Lease:   emit8(OP_LEASE);   emit32(hash<string>{}(n->s1)); break;
-        case Node::K::Sublease:emit8(OP_SUBLEASE); emit32(hash<string>{}(n->s1)); break;
-        case Node::K::Release: emit8(OP_RELEASE); emit32(hash<string>{}(n->s1)); break;
-        case Node::K::Load:    emitExpr(n->xs[0]); emit8(OP_LOAD); emit32(hash<string>{}(n->s1)); break;
+        case Node::K::Init:    emit8(OP_INIT);    emitCap(n->s1); break;
+        case Node::K::Lease:   emit8(OP_LEASE);   emitCap(n->s1); break;
+        case Node::K::Sublease:emit8(OP_SUBLEASE); emitCap(n->s1); break;
+        case Node::K::Release: emit8(OP_RELEASE); emitCap(n->s1); break;
+        case Node::K::Load:    emitLoad(n); break;
         case Node::K::Call:    for (auto& a : n->xs) emitExpr(a); emit8(OP_CALL); relocHere(n->s1); break;
         case Node::K::Exit:    emit8(OP_EXIT); break;
-        case Node::K::Render:  emit8(OP_RENDER); emit32(hash<string>{}(n->s1)); break;
-        case Node::K::Input:   emit8(OP_INPUT);  emit32(hash<string>{}(n->s1)); break;
-        case Node::K::Output:  emit8(OP_OUTPUT); emit32(hash<string>{}(n->s1)); break;
-        case Node::K::Send:    emit8(OP_SEND); emit32(hash<string>{}(n->s1)); emit32(hash<string>{}(n->s2)); break;
-        case Node::K::Recv:    emit8(OP_RECV); emit32(hash<string>{}(n->s1)); emit32(hash<string>{}(n->s2)); break;
-        case Node::K::Spawn:   for (auto& a : n->xs) emitExpr(a); emit8(OP_SPAWN); relocHere(n->s1); break;
-        case Node::K::Join:    emit8(OP_JOIN);  emit32(hash<string>{}(n->s1)); break;
-        case Node::K::Stamp:   emit8(OP_STAMP); emit32(hash<string>{}(n->s1)); emit32((uint32_t)n->i64); break;
-        case Node::K::Expire:  emit8(OP_EXPIRE); emit32(hash<string>{}(n->s1)); emit32((uint32_t)(n->du_ns & 0xFFFFFFFFu)); break;
-        case Node::K::Sleep:   emit8(OP_SLEEP); emit32((uint32_t)(n->du_ns & 0xFFFFFFFFu)); break;
+        case Node::K::Render:  emit8(OP_RENDER); emitCap(n->s1); break;
+        case Node::K::Input:   emit8(OP_INPUT);  emitCap(n->s1); break;
+        case Node::K::Output:  emit8(OP_OUTPUT); emitCap(n->s1); break;
+        case Node::K::Send:    emit8(OP_SEND); emitCap(n->s1); emitCap(n->s2); break;
+        case Node::K::Recv:    emit8(OP_RECV); emitCap(n->s1); emitCap(n->s2); break;
+        case Node::K::Spawn:   for (auto& a : n->xs) emitExpr(a); emit8(OP_SPAWN); relocHere(n->s1); emit8((uint8_t)n->xs.size()); break;
+        case Node::K::Join:    emit8(OP_JOIN);  emitCap(n->s1); break;
+        case Node::K::Stamp:   emit8(OP_STAMP); emitCap(n->s1); emit32((uint32_t)n->i64); break;
+        case Node::K::Expire:  emit8(OP_EXPIRE); emitCap(n->s1); emit64(n->du_ns); break;
+        case Node::K::Sleep:   emit8(OP_SLEEP); emit64(n->du_ns); break;
         case Node::K::Yield:   emit8(OP_YIELD); break;
-        case Node::K::Error:   emit8(OP_ERROR); emit32(hash<string>{}(n->s1)); emit32((uint32_t)n->i64); { // message
-            uint32_t off = (uint32_t)rodata.size();
-            rodata.insert(rodata.end(), n->s2.begin(), n->s2.end()); rodata.push_back(0);
-            emit32(off);
-        } break;
+        case Node::K::Error:   emit8(OP_ERROR); emitCap(n->s1); emit32((uint32_t)n->i64); strs.use(text, n->s2); break; // message
         case Node::K::If: {
-            auto cond = n->xs[0], th = n->xs[1]; shared_ptr<Node> el = n->xs.size() > 2 ? n->xs[2] : nullptr;
-            emitExpr(cond); emit8(OP_JZ); uint32_t jzpos = (uint32_t)text.size(); emit32(0xFFFFFFFFu);
+            auto cond = n->xs[0], th = n->xs[1]; Node* el = n->xs.size() > 2 ? n->xs[2] : nullptr;
+            uint32_t jzpos = emitJumpUnless(cond);
             emitBlock(th);
             if (el) {
                 emit8(OP_JMP); uint32_t jmppos = (uint32_t)text.size(); emit32(0xFFFFFFFFu);
@@ -720,193 +1468,2818 @@ struct Emitter {
             }
         } break;
         case Node::K::Loop: {
-            uint32_t start = (uint32_t)text.size(); emitExpr(n->xs[0]); emit8(OP_JZ); uint32_t jz = (uint32_t)text.size(); emit32(0xFFFFFFFFu);
+            uint32_t start = (uint32_t)text.size(), jz = emitJumpUnless(n->xs[0]);
             emitBlock(n->xs[1]); emit8(OP_JMP); emit32(start); uint32_t end = (uint32_t)text.size(); memcpy(text.data() + jz, &end, 4);
         } break;
         case Node::K::Return: { if (!n->xs.empty()) emitExpr(n->xs[0]); emit8(OP_EXIT); break; }
         case Node::K::Print: { for (auto& e : n->xs) { emitExpr(e); /* could add type-coded OP_OUTPUT here */ emit8(OP_OUTPUT); emit32(0); } break; }
-        case Node::K::Label: { mark(string(":") + n->s1); break; }
-        case Node::K::Goto: { emit8(OP_JMP); relocHere(string(":") + n->s1); break; }
+        case Node::K::Label: { mark(":" + string(n->s1)); break; }
+        case Node::K::Goto: { emit8(OP_JMP); relocHere(":" + string(n->s1)); break; }
         case Node::K::Var: case Node::K::ConstI: case Node::K::ConstStr: case Node::K::ConstBool:
         case Node::K::Bin: case Node::K::Un: case Node::K::CallExpr: { emitExpr(n); /* drop? */ break; }
         case Node::K::Block: { emitBlock(n); break; }
         default: break;
         }
     }
-    void emitBlock(const shared_ptr<Node>& b) { for (auto& s : b->xs) emitStmt(s); }
+    void emitBlock(const Node* b) { for (auto& s : b->xs) emitStmt(s); }
 
-    void emitFunc(const shared_ptr<Node>& f) {
-        string name = f->s1;
+    void emitFunc(const Node* f) {
+        string name(f->s1);
         sym_func_start[name] = (uint32_t)text.size();
         mark(name);
+        // prologue: bind arguments (pushed left-to-right by the caller) to parameter capsules
+        for (size_t i = f->xs.size() - 1; i-- > 0;) { emit8(OP_LOAD); emitCap(f->xs[i]->s1); }
         auto body = f->xs.back();
         emitBlock(body);
         // ensure exit
         emit8(OP_EXIT);
     }
 
+    static bool isTop(const Node* n) { return n->k == Node::K::Func || n->k == Node::K::Worker || (n->k == Node::K::Block && (n->s1 == "@main" || n->s1 == "@entry_point")); }
+    void emitTop(const Node* n) {
+        if (n->k != Node::K::Block) { emitFunc(n); return; }
+        sym_func_start[string(n->s1)] = (uint32_t)text.size();
+        emitBlock(n); emit8(OP_EXIT); // never fall through into the next function
+    }
+
+    // Build cache fragment (.emu): everything the Emitter merge reads from a unit.
+    void save(BlobW& w) const {
+        w.bytes(text);
+        w.u32((uint32_t)caps.names.size()); for (size_t i = 1; i < caps.names.size(); i++) w.str(caps.names[i]);
+        w.u32((uint32_t)strs.strs.size()); for (auto& x : strs.strs) w.str(x);
+        w.u32((uint32_t)strs.uses.size()); for (auto& u : strs.uses) { w.u32(u.pos); w.u32(u.id); }
+        w.u32((uint32_t)strs.naiveBytes);
+        w.u32((uint32_t)labels.size()); for (auto& kv : labels) { w.str(kv.first); w.u32(kv.second); }
+        w.u32((uint32_t)relocs.size()); for (auto& r : relocs) { w.u32(r.pos); w.str(r.sym); }
+        w.u32((uint32_t)sym_func_start.size()); for (auto& kv : sym_func_start) { w.str(kv.first); w.u32(kv.second); }
+    }
+    void load(BlobR& r) { // into a fresh UnitEmitter; throws on a malformed fragment
+        text = r.bytes();
+        for (uint32_t i = 1, n = r.u32(); i < n; i++) caps.intern(r.str());
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) strs.intern(r.str());
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) { uint32_t pos = r.u32(), id = r.u32(); strs.uses.push_back({ pos, id }); }
+        strs.naiveBytes = r.u32();
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) { string k = r.str(); labels[k] = r.u32(); }
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) { uint32_t pos = r.u32(); relocs.push_back({ pos, r.str() }); }
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) { string k = r.str(); sym_func_start[k] = r.u32(); }
+        for (auto& u : strs.uses) if (u.id >= strs.strs.size() || (size_t)u.pos + 4 > text.size()) throw runtime_error("cache: bad unit");
+        for (auto& x : relocs) if ((size_t)x.pos + 4 > text.size()) throw runtime_error("cache: bad unit");
+        check_cached_text(text, caps.names.size()); if (r.i != r.s.size()) throw runtime_error("cache: bad unit");
+    }
+};
+
+//
+// Emitter: emits runs of top-level items (~kUnitBytes of source each) as independent units on a thread pool,
+// then links them.
+//   emitUnits  parallel emit (each unit AstFold-ed first when fold is set); serial merge of capsule/string ids
+//              in unit order (so ids and rodata come out in program first-use order, as a single pass would give)
+//              and symbol resolution; parallel patching.
+//   optimize   runs the peephole optimizer per unit in parallel; branches into other units stay external.
+//   link       concatenates the units, rebases unit-relative targets and patches the external ones.
+// Unit boundaries depend only on the source, so the image does not depend on the job count.
+//
+struct Emitter {
+    using Reloc = UnitEmitter::Reloc;
     struct BuildResult {
         vector<uint8_t> text, rodata;
         unordered_map<string, uint32_t> syms;
+        vector<string> capNames; // indexed by capsule id; [0] is the reserved empty name
+        vector<uint32_t> roRefs; // text offsets of operands holding a rodata offset (string PUSHK, ERROR message)
+        vector<uint32_t> ext;    // per-unit input to the optimizer: branch operands that target another unit
+        vector<Reloc> unresolved; // CALL/SPAWN operands naming an imported symbol, bound by the module linker
     };
+    struct Ext { uint32_t pos; size_t unit; string sym; }; // branch operand resolved against another unit's symbol
+    struct Unit {
+        UnitEmitter e; vector<Ext> ext; vector<uint32_t> roRefs;
+        unordered_map<string, uint32_t> pins; // symbols other units branch to, by unit-relative offset
+    };
+
+    static constexpr uint32_t kUnitBytes = 1u << 15; // enough work per unit to amortise its tables
+
+    static constexpr size_t kExtern = SIZE_MAX; // Ext::unit of a branch to an imported symbol
+
+    deque<Unit> units; // deque: Interner/StrPool members must not move
+    Interner caps; StrPool strs; vector<uint8_t> rodata; vector<uint32_t> strOff; // strOff: rodata offset per string id
+    unordered_set<string> externs; // imported names: left for the module linker instead of "unresolved symbol"
+    const BuildCache* cache = nullptr; string_view src; // with both set, units are looked up by their source span
+    bool fold = false; // AstFold each unit first (the optimizer is on); part of the unit key
+    bool regs = false; // three-address code for call-free expressions (UnitEmitter::emitInto); part of the unit key
+    size_t nRelocs = 0; atomic<size_t> unitHits{ 0 };
+
+    void emitUnits(Node* prog, unsigned jobs = 1) {
+        vector<vector<Node*>> groups; uint32_t start = 0;
+        for (size_t i = 0; i < prog->xs.size(); i++) {
+            Node* n = prog->xs[i]; if (!UnitEmitter::isTop(n)) continue;
+            // Cut points depend on the item names, not only on offsets: an edit shifts the following bytes but the
+            // next eligible name realigns the later units, which then keep their source spans (and cache keys).
+            // The name hash is our own (FNV-1a), not std::hash, so every standard library cuts, and so emits, alike.
+            uint32_t run = n->pos - start;
+            if (groups.empty() || run >= 2 * kUnitBytes || (run >= kUnitBytes / 2 && kw_hash(n->s1, 2166136261u) % 8 == 0)) { groups.emplace_back(); start = n->pos; }
+            groups.back().push_back(n);
+        }
+        units.resize(groups.size());
+        unordered_set<string_view> gotos; if (fold) AstFold::gotoNames(prog, gotos);
+        parallel_for(groups.size(), jobs, [&](size_t u) {
+            string key; UnitEmitter& e = units[u].e;
+            if (cache && !src.empty()) {
+                uint32_t b = groups[u][0]->pos, end = u + 1 < groups.size() ? groups[u + 1][0]->pos : (uint32_t)src.size();
+                string kept; for (const Node* n : groups[u]) if (fold) AstFold::keptLabels(n, gotos, kept);
+                key = BuildCache::key({ "unit", src.substr(b, end - b), fold ? "fold" : "", kept, regs ? "regs" : "" }); string blob;
+                if (cache->load(key, ".emu", blob)) {
+                    try { BlobR r{ blob }; e.load(r); unitHits++; return; }
+                    catch (const exception&) { e = UnitEmitter(); }
+                }
+            }
+            if (fold) { AstFold f{ gotos }; for (Node* n : groups[u]) f.item(n); }
+            e.regs = regs; for (const Node* n : groups[u]) e.emitTop(n);
+            if (!key.empty()) { BlobW w; e.save(w); cache->store(key, ".emu", w.s); }
+        });
 
-    BuildResult build(const shared_ptr<Node>& prog) {
-        for (auto& n : prog->xs) {
-            if (n->k == Node::K::Func || n->k == Node::K::Worker) emitFunc(n);
-            else if (n->k == Node::K::Block && n->s1 == "@main") emitBlock(n);
-            else if (n->k == Node::K::Block && n->s1 == "@entry_point") emitBlock(n);
+        vector<vector<uint32_t>> capIds(units.size()), strIds(units.size());
+        unordered_map<string, pair<size_t, uint32_t>> labels, funcs; // last definition wins, as in one flat pass
+        for (size_t u = 0; u < units.size(); u++) {
+            UnitEmitter& e = units[u].e;
+            capIds[u].push_back(0); // id 0 stays reserved
+            for (size_t id = 1; id < e.caps.names.size(); id++) capIds[u].push_back(caps.intern(e.caps.names[id]));
+            for (auto& str : e.strs.strs) strIds[u].push_back(strs.intern(str));
+            strs.naiveBytes += e.strs.naiveBytes; nRelocs += e.relocs.size();
+            for (auto& kv : e.labels) labels[kv.first] = { u, kv.second };
+            for (auto& kv : e.sym_func_start) funcs[kv.first] = { u, kv.second };
         }
-        // resolve internal label relocs (labels map contains ":label" and functions)
-        for (auto& r : relocs) {
-            auto it = labels.find(r.sym);
-            if (it == labels.end()) {
-                auto jt = sym_func_start.find(r.sym);
-                if (jt != sym_func_start.end()) it = labels.insert({ r.sym,jt->second }).first;
+        strOff = strs.place(rodata);
+        for (size_t u = 0; u < units.size(); u++) {
+            for (auto& r : units[u].e.relocs) {
+                const pair<size_t, uint32_t>* def = nullptr; // labels first, then functions
+                if (auto it = labels.find(r.sym); it != labels.end()) def = &it->second;
+                else if (auto jt = funcs.find(r.sym); jt != funcs.end()) def = &jt->second;
+                if (!def) {
+                    if (!externs.count(r.sym)) throw runtime_error("unresolved symbol: " + r.sym);
+                    units[u].ext.push_back({ r.pos, kExtern, r.sym }); continue;
+                }
+                auto [tu, off] = *def;
+                if (tu == u) memcpy(units[u].e.text.data() + r.pos, &off, 4);
+                else { units[u].ext.push_back({ r.pos, tu, r.sym }); units[tu].pins[r.sym] = off; }
             }
-            if (it == labels.end()) throw runtime_error("unresolved symbol: " + r.sym);
-            uint32_t addr = it->second;
-            memcpy(text.data() + r.pos, &addr, 4);
         }
-        BuildResult br{ text, rodata, sym_func_start };
-        return br;
+        parallel_for(units.size(), jobs, [&](size_t u) {
+            vector<uint8_t>& t = units[u].e.text;
+            for (size_t pc = 0; pc < t.size(); pc += op_len(t[pc]))
+                for (int k = 0; k < op_caps(t[pc]); k++) { uint32_t id = capIds[u][rd_u32le(&t[pc + 1 + 4 * k])]; memcpy(&t[pc + 1 + 4 * k], &id, 4); }
+            for (auto& su : units[u].e.strs.uses) { memcpy(&t[su.pos], &strOff[strIds[u][su.id]], 4); units[u].roRefs.push_back(su.pos); }
+        });
     }
-};
 
-//
-// Peephole / Constant-fold (simple representative)
-//
-struct Optimizer {
-    static void peephole(vector<uint8_t>& code) {
-        // Pattern: PUSHK a; PUSHK b; BIN ADD -> PUSHK (a+b)
-        vector<uint8_t> out;
-        for (size_t i = 0; i < code.size();) {
-            if (i + 11 < code.size() && code[i] == OP_PUSHK && code[i + 5] == OP_PUSHK && code[i + 10] == OP_BIN) {
-                uint32_t a = rd_u32le(&code[i + 1]), b = rd_u32le(&code[i + 6]); uint8_t bop = code[i + 11];
-                if (bop == B_ADD || bop == B_SUB || bop == B_MUL || bop == B_DIV || bop == B_MOD) {
-                    long long r = 0;
-                    if (bop == B_ADD) r = (long long)a + (long long)b;
-                    else if (bop == B_SUB) r = (long long)a - (long long)b;
-                    else if (bop == B_MUL) r = (long long)a * (long long)b;
-                    else if (bop == B_DIV) r = (b ? (long long)a / (long long)b : 0);
-                    else if (bop == B_MOD) r = (b ? (long long)a % (long long)b : 0);
-                    out.push_back(OP_PUSHK); string s = u32le((uint32_t)r); out.insert(out.end(), s.begin(), s.end());
-                    i += 12; continue;
-                }
+    void optimizeUnits(unsigned jobs = 1); // defined after Optimizer
+
+    size_t textBytes() const { size_t n = 0; for (auto& u : units) n += u.e.text.size(); return n; }
+
+    BuildResult link() {
+        BuildResult br; vector<uint32_t> base(units.size());
+        for (size_t u = 0; u < units.size(); u++) { base[u] = (uint32_t)br.text.size(); br.text.insert(br.text.end(), units[u].e.text.begin(), units[u].e.text.end()); }
+        for (size_t u = 0; u < units.size(); u++) {
+            Unit& x = units[u]; uint8_t* t = br.text.data() + base[u]; size_t n = x.e.text.size();
+            unordered_set<uint32_t> ext; for (auto& r : x.ext) ext.insert(r.pos);
+            for (size_t pc = 0; pc < n; pc += op_len(t[pc])) {
+                size_t o = op_target(t[pc]);
+                if (o && !ext.count((uint32_t)(pc + o))) { uint32_t a = rd_u32le(&t[pc + o]) + base[u]; memcpy(&t[pc + o], &a, 4); }
+            }
+            for (auto& r : x.ext) {
+                if (r.unit == kExtern) { br.unresolved.push_back({ base[u] + r.pos, r.sym }); continue; }
+                uint32_t a = base[r.unit] + units[r.unit].pins.at(r.sym); memcpy(&t[r.pos], &a, 4);
             }
-            out.push_back(code[i]); i++;
+            for (auto& kv : x.e.sym_func_start) br.syms[kv.first] = base[u] + kv.second;
+            for (uint32_t r : x.roRefs) br.roRefs.push_back(base[u] + r);
         }
-        code.swap(out);
+        br.rodata = rodata; br.capNames = caps.table();
+        return br;
+    }
+
+    BuildResult build(Node* prog, unsigned jobs = 1, bool optimize = false) {
+        fold = optimize; emitUnits(prog, jobs); if (optimize) optimizeUnits(jobs);
+        return link();
     }
 };
 
 //
-// Disassembler
+// Peephole optimizer (decoded, relocation-aware, runs to a fixpoint)
+//   Decodes text into an instruction list, turns JZ/JNZ/JMP/CALL/SPAWN targets and symbol offsets into
+//   instruction indices (labels), rewrites the list until nothing changes, lays its basic blocks out again
+//   (layout, then another round of rewrites), then re-encodes and re-patches.
 //
-static string disasm(const vector<uint8_t>& code) {
-    auto mn = [&](uint8_t op)->string {
-        switch (op) {
-        case OP_INIT:return "INIT"; case OP_LEASE:return "LEASE"; case OP_SUBLEASE:return "SUBLEASE";
-        case OP_RELEASE:return "RELEASE"; case OP_LOAD:return "LOAD"; case OP_CALL:return "CALL"; case OP_EXIT:return "EXIT";
-        case OP_RENDER:return "RENDER"; case OP_INPUT:return "INPUT"; case OP_OUTPUT:return "OUTPUT";
-        case OP_SEND:return "SEND"; case OP_RECV:return "RECV"; case OP_SPAWN:return "SPAWN"; case OP_JOIN:return "JOIN";
-        case OP_STAMP:return "STAMP"; case OP_EXPIRE:return "EXPIRE"; case OP_SLEEP:return "SLEEP"; case OP_YIELD:return "YIELD"; case OP_ERROR:return "ERROR";
-        case OP_PUSHK:return "PUSHK"; case OP_PUSHCAP:return "PUSHCAP"; case OP_UN:return "UN"; case OP_BIN:return "BIN";
-        case OP_JZ:return "JZ"; case OP_JNZ:return "JNZ"; case OP_JMP:return "JMP";
-        case OP_END:return "END"; default: return "DB";
+struct Optimizer {
+    struct Insn { uint8_t op = 0, b = 0, ro = 0; uint32_t a[3] = { 0, 0, 0 }; size_t tgt = 0; bool dead = false; uint32_t ext = 0; };
+    // ro: bit k = a[k] is a rodata offset; ext: 1 + index into BuildResult::ext when the target lies outside this text
+    static bool isBranch(uint8_t op) { return op_target(op) != 0; }
+    static size_t tslot(uint8_t op) { return (op_target(op) - 1) / 4; } // a[] index of a branch's target
+
+    vector<Insn> code;
+    vector<pair<string, size_t>> syms; // symbol -> instruction index
+    vector<char> entry;                // instruction is a branch target or symbol (control may enter here)
+
+    // Returns false (and leaves the image untouched) if the text does not decode cleanly.
+    bool decode(const Emitter::BuildResult& br) {
+        const vector<uint8_t>& t = br.text; unordered_map<uint32_t, size_t> at;
+        for (size_t i = 0; i < t.size();) {
+            size_t len = op_len(t[i]); if (!len || i + len > t.size()) return false;
+            Insn in; in.op = t[i];
+            for (size_t k = 0; k < op_fields(in.op); k++) in.a[k] = rd_u32le(&t[i + 1 + 4 * k]);
+            if (len > 1 + 4 * op_fields(in.op)) in.b = t[i + len - 1]; // UN/BIN/BINCAP/BINK operator, SPAWN argc
+            at[(uint32_t)i] = code.size(); code.push_back(in); i += len;
         }
-        };
-    stringstream ss; size_t i = 0;
-    while (i < code.size()) {
-        uint8_t op = code[i++]; ss << setw(6) << setfill('0') << hex << i - 1 << ": " << mn(op);
-        if (op == OP_PUSHK || op == OP_PUSHCAP || op == OP_LOAD || op == OP_INIT || op == OP_LEASE || op == OP_SUBLEASE || op == OP_RELEASE ||
-            op == OP_RENDER || op == OP_INPUT || op == OP_OUTPUT || op == OP_SEND || op == OP_RECV || op == OP_JOIN || op == OP_STAMP || op == OP_EXPIRE || op == OP_SLEEP || op == OP_JMP || op == OP_CALL || op == OP_ERROR) {
-            uint32_t v = rd_u32le(&code[i]); i += 4; ss << " " << dec << v;
-            if (op == OP_SEND || op == OP_RECV) { uint32_t v2 = rd_u32le(&code[i]); i += 4; ss << "," << v2; }
-            if (op == OP_ERROR) { uint32_t msg = rd_u32le(&code[i]); i += 4; ss << " msg@" << msg; }
+        at[(uint32_t)t.size()] = code.size();
+        for (uint32_t r : br.roRefs) {
+            bool hit = false;
+            for (uint32_t k = 0; k < 3 && !hit && r >= 1 + 4 * k; k++) {
+                auto it = at.find(r - 1 - 4 * k); if (it != at.end() && it->second < code.size()) { code[it->second].ro |= (uint8_t)(1u << k); hit = true; }
+            }
+            if (!hit) return false;
+        }
+        for (uint32_t i = 0; i < br.ext.size(); i++) { // the operand position names the instruction through its target offset
+            size_t hit = SIZE_MAX;
+            for (uint32_t o : { 1u, 9u }) {
+                auto it = br.ext[i] >= o ? at.find(br.ext[i] - o) : at.end();
+                if (it != at.end() && it->second < code.size() && op_target(code[it->second].op) == o) hit = it->second;
+            }
+            if (hit == SIZE_MAX) return false;
+            code[hit].ext = i + 1;
         }
-        else if (op == OP_BIN || op == OP_UN) {
-            uint8_t b = code[i++]; ss << " " << (int)b;
+        for (auto& in : code) if (isBranch(in.op) && !in.ext) {
+            auto it = at.find(in.a[tslot(in.op)]); if (it == at.end()) return false; in.tgt = it->second;
         }
-        else if (op == OP_JZ || op == OP_JNZ) {
-            uint32_t v = rd_u32le(&code[i]); i += 4; ss << " ->" << v;
+        for (auto& kv : br.syms) {
+            auto it = at.find(kv.second); if (it == at.end()) return false; syms.push_back({ kv.first, it->second });
         }
-        ss << "\n";
+        return true;
     }
-    return ss.str();
-}
 
-//
-// Hex writer for .text.hex
-//
-static string dump_hex(const vector<uint8_t>& v) {
-    string s; for (size_t i = 0; i < v.size(); ++i) { if (i) s.push_back(' '); s += hex2(v[i]); } return s;
-}
-
-//
-// CLI driver
-//
-struct Cmd {
-    string inPath, outDir = "out";
-    bool wantDisasm = true;
-};
-static Cmd parseArgs(int argc, char** argv) {
-    Cmd c;
-    for (int i = 1; i < argc; i++) {
-        string a = argv[i];
-        if (a == "-o" && i + 1 < argc) { c.outDir = argv[++i]; }
-        else if (a == "--no-disasm") { c.wantDisasm = false; }
-        else if (c.inPath.empty()) { c.inPath = a; }
-        else throw runtime_error("unknown arg: " + a);
+    void markEntries() {
+        entry.assign(code.size() + 1, 0);
+        for (auto& in : code) if (isBranch(in.op) && !in.ext) entry[in.tgt] = 1;
+        for (auto& s : syms) entry[s.second] = 1;
     }
-    if (c.inPath.empty()) throw runtime_error("usage: eminorcc <input.eminor> [-o outdir] [--no-disasm]");
-    return c;
-}
-
-int main(int argc, char** argv) {
-    ios::sync_with_stdio(false);
-    try {
-        Cmd cmd = parseArgs(argc, argv);
-        string src = read_file(cmd.inPath);
 
-        // Parse
-        Parser ps(src);
-        auto ast = ps.parse();
+    // PUSHK carries a zero-extended u32; only fold when the result is representable.
+    static bool fitsK(long long r) { return r >= 0 && r <= 0xFFFFFFFFLL; }
 
-        // Star-Code validations
-        StarCode sc; sc.run(ast);
-        for (auto& d : sc.diags) {
-            cerr << d.kind << ": " << d.msg << " @" << d.line << ":" << d.col << "\n";
-            if (d.kind == "error") throw runtime_error("star-code error");
-        }
+    bool pass() {
+        bool changed = false; markEntries();
+        size_t n = code.size();
+        auto next = [&](size_t i) { do i++; while (i < n && code[i].dead); return i; }; // next live instruction
+        for (size_t i = 0; i < n; i++) {
+            Insn& x = code[i]; if (x.dead) continue;
+            size_t j = next(i), k = j < n ? next(j) : n;
+            Insn* y = j < n && !entry[j] ? &code[j] : nullptr;  // fusable successors: nothing may jump between them
+            Insn* z = y && k < n && !entry[k] ? &code[k] : nullptr;
+            long long r = 0;
+            // PUSHK a; PUSHK b; BIN op -> PUSHK (a op b)
+            if (x.op == OP_PUSHK && y && y->op == OP_PUSHK && z && z->op == OP_BIN &&
+                eval_bin(z->b, x.a[0], y->a[0], r) && fitsK(r)) {
+                x.a[0] = (uint32_t)r; x.ro = 0; y->dead = z->dead = true; changed = true; continue;
+            }
+            // PUSHK a; UN op -> PUSHK (op a)
+            if (x.op == OP_PUSHK && y && y->op == OP_UN && eval_un(y->b, x.a[0], r) && fitsK(r)) {
+                x.a[0] = (uint32_t)r; x.ro = 0; y->dead = true; changed = true; continue;
+            }
+            // UN -; UN - and UN ~; UN ~ cancel out
+            if (x.op == OP_UN && (x.b == 2 || x.b == 3) && y && y->op == OP_UN && y->b == x.b) {
+                x.dead = y->dead = true; changed = true; continue;
+            }
+            // UN !; JZ t -> JNZ t (and vice versa)
+            if (x.op == OP_UN && x.b == 1 && y && (y->op == OP_JZ || y->op == OP_JNZ)) {
+                y->op = y->op == OP_JZ ? OP_JNZ : OP_JZ; x.dead = true; changed = true; continue;
+            }
+            // PUSHK k; JZ/JNZ t -> JMP t or nothing
+            if (x.op == OP_PUSHK && y && (y->op == OP_JZ || y->op == OP_JNZ)) {
+                bool taken = (y->op == OP_JZ) == (x.a[0] == 0);
+                x.dead = true; if (taken) y->op = OP_JMP; else y->dead = true;
+                changed = true; continue;
+            }
+            // Superinstructions (after folding has had its chance on the same sequence)
+            Insn* w = nullptr;
+            if (z) { size_t l = next(k); w = l < n && !entry[l] ? &code[l] : nullptr; }
+            // PUSHCAP c; PUSHK k; BIN cmp; JZ/JNZ t -> CMPJ<cmp> c, k, t (JNZ jumps when the negated comparison fails)
+            if (x.op == OP_PUSHCAP && y && y->op == OP_PUSHK && !y->ro && z && z->op == OP_BIN && is_cmp(z->b) && w && (w->op == OP_JZ || w->op == OP_JNZ) && !w->ext) {
+                uint8_t cmp = w->op == OP_JZ ? z->b : cmp_negate(z->b); size_t t = w->tgt;
+                uint32_t c = x.a[0], kv = y->a[0]; x = Insn{}; x.op = cmpj_of(cmp); x.a[0] = c; x.a[1] = kv; x.tgt = t;
+                y->dead = z->dead = w->dead = true; changed = true; continue;
+            }
+            // PUSHCAP c; PUSHK k; BIN +; LOAD c -> INCCAP c, k (and PUSHK k; PUSHCAP c; ...)
+            if (y && z && z->op == OP_BIN && z->b == B_ADD && w && w->op == OP_LOAD &&
+                ((x.op == OP_PUSHCAP && y->op == OP_PUSHK && !y->ro && x.a[0] == w->a[0]) || (x.op == OP_PUSHK && !x.ro && y->op == OP_PUSHCAP && y->a[0] == w->a[0]))) {
+                uint32_t c = w->a[0], kv = x.op == OP_PUSHK ? x.a[0] : y->a[0]; x = Insn{}; x.op = OP_INCCAP; x.a[0] = c; x.a[1] = kv;
+                y->dead = z->dead = w->dead = true; changed = true; continue;
+            }
+            // PUSHK k; LOAD c -> LOAD_K c, k (a rodata offset stays one)
+            if (x.op == OP_PUSHK && y && y->op == OP_LOAD) {
+                uint32_t kv = x.a[0]; uint8_t ro = x.ro; x.op = OP_LOAD_K; x.a[0] = y->a[0]; x.a[1] = kv; x.ro = (uint8_t)(ro << 1);
+                y->dead = true; changed = true; continue;
+            }
+            // PUSHCAP a; PUSHCAP b -> PUSHCAP2 a, b, unless b starts one of the longer forms above
+            if (x.op == OP_PUSHCAP && y && y->op == OP_PUSHCAP && !(k < n && code[k].op == OP_PUSHK)) { x.op = OP_PUSHCAP2; x.a[1] = y->a[0]; y->dead = true; changed = true; continue; }
+            if ((op_cond_branch(x.op) || x.op == OP_JMP) && !x.ext) {
+                // thread JMP chains (bounded, so a JMP cycle is left alone; a JMP out of the unit has no tgt to follow)
+                for (int hop = 0; hop < 64 && x.tgt < n && code[x.tgt].op == OP_JMP && !code[x.tgt].dead && !code[x.tgt].ext && code[x.tgt].tgt != x.tgt; hop++) {
+                    x.tgt = code[x.tgt].tgt; changed = true;
+                }
+                // branch to the next live instruction is a no-op (conditional ones still pop)
+                if (x.op == OP_JMP && next(i) == x.tgt) { x.dead = true; changed = true; continue; }
+                // JMP to EXIT -> EXIT
+                if (x.op == OP_JMP && x.tgt < n && code[x.tgt].op == OP_EXIT && !code[x.tgt].ext) { x = Insn{}; x.op = OP_EXIT; changed = true; }
+            }
+            // nothing falls into the code after an unconditional JMP/EXIT until the next label
+            if (x.op == OP_JMP || x.op == OP_EXIT || x.op == OP_END) {
+                for (size_t d = i + 1; d < n && !entry[d]; d++) if (!code[d].dead) { code[d].dead = true; changed = true; }
+            }
+        }
+        if (changed) compact();
+        return changed;
+    }
+
+    // Drop dead instructions; labels on a dead instruction move to the next live one.
+    void compact() {
+        size_t n = code.size(); vector<size_t> remap(n + 1); size_t m = 0;
+        for (size_t i = 0; i < n; i++) { remap[i] = m; if (!code[i].dead) m++; }
+        remap[n] = m;
+        vector<Insn> out; out.reserve(m);
+        for (auto& in : code) if (!in.dead) { out.push_back(in); if (isBranch(in.op) && !in.ext) out.back().tgt = remap[in.tgt]; }
+        for (auto& s : syms) s.second = remap[s.second];
+        code.swap(out);
+    }
+
+    //
+    // Control-flow graph: the instruction list as basic blocks with fall-through and branch successors.
+    //   CALL and SPAWN stay inside a block; their targets are roots, like the symbols (function starts and the
+    //   labels other units branch to). layout() drops the blocks no root reaches, inverts loops whose latch jumps
+    //   back to a short test (the test is copied over the JMP with its branch negated, so an iteration takes one
+    //   branch instead of two), then places each run of fall-through blocks right after a block that jumps to
+    //   its head and drops that JMP. Any layout keeps every cycle spanned by backward jumps (VM fuel, planChannels).
+    //
+    static constexpr size_t kNoBlock = SIZE_MAX, kEndBlock = SIZE_MAX - 1; // no successor / runs off the end of the text
+    static constexpr size_t kMaxTestCopy = 4; // instructions of a loop test copied into its latch
+    struct Block { size_t b, e, fall = kNoBlock, jump = kNoBlock; }; // code[b, e)
+    static bool endsBlock(uint8_t op) { return op_cond_branch(op) || op == OP_JMP || op == OP_EXIT || op == OP_END; }
+    static uint8_t negateBranch(uint8_t op) { return op == OP_JZ ? (uint8_t)OP_JNZ : op == OP_JNZ ? (uint8_t)OP_JZ : (uint8_t)cmpj_of(cmp_negate(cmp_of_cmpj(op))); }
+
+    vector<Block> blocks(vector<size_t>& blockAt) const {
+        size_t n = code.size(); vector<char> lead(n + 1, 0); lead[0] = 1;
+        for (size_t i = 0; i < n; i++) {
+            if (isBranch(code[i].op) && !code[i].ext) lead[code[i].tgt] = 1;
+            if (endsBlock(code[i].op)) lead[i + 1] = 1;
+        }
+        for (auto& s : syms) lead[s.second] = 1;
+        vector<Block> bs; blockAt.assign(n + 1, kEndBlock);
+        for (size_t i = 0; i < n; i++) { if (lead[i]) { if (!bs.empty()) bs.back().e = i; bs.push_back({ i, n }); } blockAt[i] = bs.size() - 1; }
+        for (size_t k = 0; k < bs.size(); k++) {
+            const Insn& x = code[bs[k].e - 1];
+            if ((x.op == OP_JMP || op_cond_branch(x.op)) && !x.ext) bs[k].jump = blockAt[x.tgt];
+            if (x.op != OP_JMP && x.op != OP_EXIT && x.op != OP_END) bs[k].fall = bs[k].e < n ? k + 1 : kEndBlock;
+        }
+        return bs;
+    }
+
+    bool layout() {
+        size_t n = code.size(); if (!n) return false;
+        vector<size_t> blockAt; vector<Block> bs = blocks(blockAt); size_t nb = bs.size();
+        vector<char> live(nb, 0); vector<size_t> work;
+        auto reach = [&](size_t k) { if (k < nb && !live[k]) { live[k] = 1; work.push_back(k); } };
+        for (auto& s : syms) reach(blockAt[s.second]);
+        while (!work.empty()) {
+            size_t k = work.back(); work.pop_back(); reach(bs[k].fall); reach(bs[k].jump);
+            for (size_t i = bs[k].b; i < bs[k].e; i++) if ((code[i].op == OP_CALL || code[i].op == OP_SPAWN) && !code[i].ext) reach(blockAt[code[i].tgt]);
+        }
+        vector<size_t> seq; for (size_t k = 0; k < nb; k++) if (live[k]) seq.push_back(k);
+        bool changed = seq.size() != nb;
+
+        // Loop inversion: L ends in JMP H, H is a short test whose exit is the block right after L
+        vector<size_t> inv(nb, kNoBlock);
+        for (size_t s = 0; s + 1 < seq.size(); s++) {
+            size_t l = seq[s], h = bs[l].jump; if (code[bs[l].e - 1].op != OP_JMP || h >= nb || h == l) continue;
+            const Block& H = bs[h]; const Insn& t = code[H.e - 1];
+            if (!op_cond_branch(t.op) || t.ext || H.jump != seq[s + 1] || H.fall >= nb || H.e - H.b > kMaxTestCopy) continue;
+            bool ext = false; for (size_t i = H.b; i < H.e; i++) ext |= code[i].ext != 0; // an external operand has one slot
+            if (ext) continue;
+            inv[l] = h; bs[l].fall = seq[s + 1]; changed = true;
+        }
+
+        // Chains of fall-through blocks; a chain whose tail jumps to another chain's head is placed before it
+        vector<size_t> chainOf(nb, kNoBlock), heads; // heads: first block of each chain, in order
+        for (size_t s = 0; s < seq.size(); s++) {
+            size_t k = seq[s]; if (!s || bs[seq[s - 1]].fall == kNoBlock) heads.push_back(k);
+            chainOf[k] = heads.size() - 1;
+        }
+        size_t nc = heads.size(); vector<size_t> tail(nc), next(nc, kNoBlock); vector<char> hasPred(nc, 0), drop(nb, 0);
+        for (size_t s = 0; s < seq.size(); s++) tail[chainOf[seq[s]]] = seq[s];
+        size_t lastChain = bs[seq.back()].fall == kEndBlock ? chainOf[seq.back()] : kNoBlock; // must stay last
+        for (size_t c = 0; c < nc; c++) {
+            size_t t = tail[c], j = bs[t].jump;
+            if (inv[t] != kNoBlock || code[bs[t].e - 1].op != OP_JMP || j >= nb) continue;
+            size_t d = chainOf[j]; if (heads[d] != j || d == c || hasPred[d] || d == lastChain) continue;
+            bool cycle = false; for (size_t x = d; x != kNoBlock && !cycle; x = next[x]) cycle = x == c;
+            if (cycle) continue;
+            next[c] = d; hasPred[d] = 1; drop[t] = 1; changed = true;
+        }
+        if (!changed) return false;
+
+        vector<size_t> order;
+        auto place = [&](size_t c) { for (; c != kNoBlock; c = next[c]) for (size_t s = 0; s < seq.size(); s++) if (chainOf[seq[s]] == c) order.push_back(seq[s]); };
+        for (size_t c = 0; c < nc; c++) if (!hasPred[c] && c != lastChain) place(c);
+        if (lastChain != kNoBlock) place(lastChain);
+
+        vector<Insn> out; out.reserve(n); vector<size_t> at(n + 1, 0); // at: old block start -> new index
+        for (size_t k : order) {
+            at[bs[k].b] = out.size();
+            size_t e = drop[k] || inv[k] != kNoBlock ? bs[k].e - 1 : bs[k].e; // without its JMP
+            out.insert(out.end(), code.begin() + bs[k].b, code.begin() + e);
+            if (inv[k] == kNoBlock) continue;
+            const Block& H = bs[inv[k]];
+            out.insert(out.end(), code.begin() + H.b, code.begin() + H.e);
+            out.back().op = negateBranch(out.back().op); out.back().tgt = bs[H.fall].b; // back into the body
+        }
+        at[n] = out.size();
+        for (auto& x : out) if (isBranch(x.op) && !x.ext) x.tgt = at[x.tgt];
+        for (auto& s : syms) s.second = at[s.second];
+        code.swap(out);
+        return true;
+    }
+
+    void encode(Emitter::BuildResult& br) const {
+        vector<uint32_t> off(code.size() + 1); uint32_t pos = 0;
+        for (size_t i = 0; i < code.size(); i++) { off[i] = pos; pos += (uint32_t)op_len(code[i].op); }
+        off[code.size()] = pos;
+        vector<uint8_t> t; t.reserve(pos); br.roRefs.clear(); br.ext.assign(br.ext.size(), ~0u); // ~0u: branch was removed
+        auto put32 = [&](uint32_t v) { auto s = u32le(v); t.insert(t.end(), s.begin(), s.end()); };
+        for (auto& in : code) {
+            size_t len = op_len(in.op), nf = op_fields(in.op); t.push_back(in.op);
+            for (size_t k = 0; k < nf; k++) {
+                bool tk = isBranch(in.op) && k == tslot(in.op);
+                if (in.ro >> k & 1) br.roRefs.push_back((uint32_t)t.size());
+                if (tk && in.ext) br.ext[in.ext - 1] = (uint32_t)t.size();
+                put32(tk && !in.ext ? off[in.tgt] : in.a[k]);
+            }
+            if (len > 1 + 4 * nf) t.push_back(in.b);
+        }
+        br.text.swap(t);
+        for (auto& s : syms) br.syms[s.first] = off[s.second];
+    }
+
+    static void peephole(Emitter::BuildResult& br) {
+        Optimizer o; if (!o.decode(br)) return;
+        while (o.pass()) {}
+        if (o.layout()) while (o.pass()) {}
+        o.encode(br);
+    }
+};
+
+// Each unit is optimized on its own: its entry points are its function symbol plus every label another unit
+// branches to, and branches into other units are opaque (not threaded), so units never touch each other.
+inline void Emitter::optimizeUnits(unsigned jobs) {
+    parallel_for(units.size(), jobs, [&](size_t u) {
+        Unit& x = units[u]; BuildResult br;
+        br.text.swap(x.e.text); br.roRefs.swap(x.roRefs);
+        br.syms = x.e.sym_func_start; for (auto& kv : x.pins) br.syms[kv.first] = kv.second;
+        for (auto& r : x.ext) br.ext.push_back(r.pos);
+        Optimizer::peephole(br);
+        x.e.text.swap(br.text); x.roRefs.swap(br.roRefs);
+        for (auto& kv : x.e.sym_func_start) kv.second = br.syms[kv.first];
+        for (auto& kv : x.pins) kv.second = br.syms[kv.first];
+        size_t m = 0;
+        for (size_t i = 0; i < x.ext.size(); i++) if (br.ext[i] != ~0u) { x.ext[m] = x.ext[i]; x.ext[m++].pos = br.ext[i]; }
+        x.ext.resize(m);
+    });
+}
+
+//
+// Disassembler and hex writer
+//   Both stream through OutBuf, a fixed buffer with hand-rolled number formatting, into a file or a string, so a
+//   listing is never built up in a stringstream and copied again. Operands print in decimal except SPAWN/JZ/JNZ
+//   targets and UN/BIN operators, which are hex (the listing format predates this writer).
+//
+struct OutBuf {
+    static constexpr size_t kSize = 1u << 16;
+    ostream* os = nullptr; string* str = nullptr; size_t n = 0; char b[kSize];
+    explicit OutBuf(ostream& o) : os(&o) {}
+    explicit OutBuf(string& s) : str(&s) {}
+    ~OutBuf() { flush(); }
+    OutBuf(const OutBuf&) = delete; OutBuf& operator=(const OutBuf&) = delete;
+    void flush() { if (os) os->write(b, (streamsize)n); else str->append(b, n); n = 0; }
+    char* room(size_t k) { if (n + k > kSize) flush(); return b + n; } // k <= kSize
+    void put(char c) { *room(1) = c; n++; }
+    void put(string_view v) {
+        if (v.size() > kSize) { flush(); if (os) os->write(v.data(), (streamsize)v.size()); else str->append(v); return; }
+        memcpy(room(v.size()), v.data(), v.size()); n += v.size();
+    }
+    void dec(unsigned long long v) { char t[20]; size_t k = 0; do { t[k++] = (char)('0' + v % 10); v /= 10; } while (v); char* p = room(k); n += k; while (k) *p++ = t[--k]; }
+    void hex(unsigned long long v, size_t width = 1) { // lowercase, zero-padded to width
+        char t[16]; size_t k = 0; do { t[k++] = "0123456789abcdef"[v & 15]; v >>= 4; } while (v);
+        while (k < width && k < sizeof t) t[k++] = '0';
+        char* p = room(k); n += k; while (k) *p++ = t[--k];
+    }
+};
+
+static const char* op_name(uint8_t op) {
+    switch (op) {
+    case OP_INIT:return "INIT"; case OP_LEASE:return "LEASE"; case OP_SUBLEASE:return "SUBLEASE";
+    case OP_RELEASE:return "RELEASE"; case OP_LOAD:return "LOAD"; case OP_CALL:return "CALL"; case OP_EXIT:return "EXIT";
+    case OP_RENDER:return "RENDER"; case OP_INPUT:return "INPUT"; case OP_OUTPUT:return "OUTPUT";
+    case OP_SEND:return "SEND"; case OP_RECV:return "RECV"; case OP_SPAWN:return "SPAWN"; case OP_JOIN:return "JOIN";
+    case OP_STAMP:return "STAMP"; case OP_EXPIRE:return "EXPIRE"; case OP_SLEEP:return "SLEEP"; case OP_YIELD:return "YIELD"; case OP_ERROR:return "ERROR";
+    case OP_PUSHK:return "PUSHK"; case OP_PUSHCAP:return "PUSHCAP"; case OP_UN:return "UN"; case OP_BIN:return "BIN";
+    case OP_JZ:return "JZ"; case OP_JNZ:return "JNZ"; case OP_JMP:return "JMP";
+    case OP_PUSHCAP2:return "PUSHCAP2"; case OP_LOAD_K:return "LOAD_K"; case OP_INCCAP:return "INCCAP";
+    case OP_MOVCAP:return "MOVCAP"; case OP_BINCAP:return "BINCAP"; case OP_BINK:return "BINK";
+    case OP_CMPJEQ:return "CMPJEQ"; case OP_CMPJNE:return "CMPJNE"; case OP_CMPJLT:return "CMPJLT";
+    case OP_CMPJGT:return "CMPJGT"; case OP_CMPJLE:return "CMPJLE"; case OP_CMPJGE:return "CMPJGE";
+    case OP_END:return "END"; default: return "DB";
+    }
+}
+
+// Lists the wide-form instructions of code[0, n) that start in [from, to). Decoding begins at from, or at the
+// nearest entry of starts (sorted instruction boundaries, e.g. function starts) below it when from may be mid-instruction.
+static void disasm(OutBuf& o, const uint8_t* code, size_t n, size_t from = 0, size_t to = SIZE_MAX, const vector<uint32_t>* starts = nullptr) {
+    size_t i = from;
+    if (starts) { auto it = upper_bound(starts->begin(), starts->end(), (uint32_t)min<size_t>(from, UINT32_MAX)); i = it == starts->begin() ? 0 : *--it; }
+    to = min(to, n);
+    while (i < to) {
+        uint8_t op = code[i]; size_t len = max<size_t>(op_len(op), 1);
+        if (i + len > n) len = 1; // truncated: the opcode byte alone, as DB
+        if (i < from) { i += len; continue; }
+        const uint8_t* p = code + i + 1; auto k = [&](size_t f) { return rd_u32le(p + 4 * f); };
+        o.hex(i, 6); o.put(": "); o.put(len == 1 && op_len(op) > 1 ? "DB" : op_name(op));
+        if (len == 1) {}
+        else if (op == OP_PUSHK || op == OP_PUSHCAP || op == OP_LOAD || op == OP_INIT || op == OP_LEASE || op == OP_SUBLEASE || op == OP_RELEASE ||
+            op == OP_RENDER || op == OP_INPUT || op == OP_OUTPUT || op == OP_SEND || op == OP_RECV || op == OP_JOIN || op == OP_STAMP || op == OP_JMP || op == OP_CALL || op == OP_ERROR) {
+            o.put(' '); o.dec(k(0));
+            if (op == OP_SEND || op == OP_RECV) { o.put(','); o.dec(k(1)); }
+            if (op == OP_ERROR) { o.put(" msg@"); o.dec(k(2)); }
+        }
+        else if (op == OP_EXPIRE || op == OP_SLEEP) { // [c] ns
+            size_t f = 0; if (op == OP_EXPIRE) { o.put(' '); o.dec(k(f++)); }
+            o.put(' '); o.dec(k(f) | (unsigned long long)k(f + 1) << 32); o.put("ns");
+        }
+        else if (op == OP_SPAWN) { o.put(" ->"); o.hex(k(0)); o.put(" argc="); o.dec(p[4]); }
+        else if (op == OP_BIN || op == OP_UN) { o.put(' '); o.hex(p[0]); }
+        else if (op == OP_JZ || op == OP_JNZ) { o.put(" ->"); o.hex(k(0)); }
+        else if (op == OP_BINCAP || op == OP_BINK) { // d a,b op / d a k op
+            o.put(' '); o.dec(k(0)); o.put(' '); o.dec(k(1)); o.put(op == OP_BINCAP ? ',' : ' '); o.dec(k(2)); o.put(' '); o.dec(p[12]);
+        }
+        else if (op == OP_PUSHCAP2 || op == OP_LOAD_K || op == OP_INCCAP || op == OP_MOVCAP) { o.put(' '); o.dec(k(0)); o.put(op == OP_PUSHCAP2 ? ',' : ' '); o.dec(k(1)); }
+        else if (op_is_cmpj(op)) { o.put(' '); o.dec(k(0)); o.put(' '); o.dec(k(1)); o.put(" ->"); o.hex(k(2)); }
+        o.put('\n'); i += len;
+    }
+}
+
+// Instruction boundaries to split or seek a listing at: the symbol values inside TEXT, sorted and unique.
+template <class It> static vector<uint32_t> disasm_starts(It b, It e, size_t n) {
+    vector<uint32_t> s; for (; b != e; ++b) if (b->second < n) s.push_back(b->second);
+    sort(s.begin(), s.end()); s.erase(unique(s.begin(), s.end()), s.end()); return s;
+}
+
+// Writes the whole listing to path. A large text is cut at function starts into pieces listed on jobs threads.
+static inline void write_disasm(const string& path, const uint8_t* code, size_t n, const vector<uint32_t>& starts, unsigned jobs) {
+    auto dir = filesystem::path(path).parent_path(); if (!dir.empty()) filesystem::create_directories(dir);
+    ofstream f(path, ios::binary); if (!f) throw runtime_error("cannot write: " + path);
+    if (!jobs) jobs = max(1u, thread::hardware_concurrency());
+    constexpr size_t kPiece = 1u << 20; // text bytes per piece, at least
+    if (jobs < 2 || n < 2 * kPiece) { OutBuf o(f); disasm(o, code, n); return; }
+    vector<size_t> cut{ 0 }; for (uint32_t s : starts) if (s >= cut.back() + kPiece) cut.push_back(s);
+    cut.push_back(n);
+    vector<string> part(cut.size() - 1);
+    parallel_for(part.size(), jobs, [&](size_t i) { OutBuf o(part[i]); disasm(o, code, n, cut[i], cut[i + 1]); });
+    for (auto& s : part) f.write(s.data(), (streamsize)s.size());
+}
+
+// .text.hex: two uppercase digits per byte, space-separated.
+static inline void write_hex(const string& path, const uint8_t* v, size_t n) {
+    auto dir = filesystem::path(path).parent_path(); if (!dir.empty()) filesystem::create_directories(dir);
+    ofstream f(path, ios::binary); if (!f) throw runtime_error("cannot write: " + path);
+    OutBuf o(f); static const char* d = "0123456789ABCDEF";
+    for (size_t i = 0; i < n; i++) { char* p = o.room(3); size_t k = 0; if (i) p[k++] = ' '; p[k++] = d[v[i] >> 4]; p[k++] = d[v[i] & 15]; o.n += k; }
+}
+
+//
+// Object image (a.emo): one little-endian file that a runtime maps and executes in place
+//   [ObjHeader][TEXT + kTextPad x END][DATA][RODATA][SYMS][RELOCS][CAPS][STRS], each section kObjAlign-aligned.
+//   TEXT operands are already section-relative (addresses into TEXT, offsets into RODATA, capsule ids), so
+//   running needs no fixups; RELOCS (sorted by offset) tell a linker which operands to rebase when merging.
+//   SYMS is sorted bytewise by name for binary search; names live NUL-terminated in STRS. CAPS maps id -> name.
+//
+enum ObjSec : uint32_t { SEC_TEXT, SEC_DATA, SEC_RODATA, SEC_SYMS, SEC_RELOCS, SEC_CAPS, SEC_STRS, SEC_POOL, SEC_COUNT }; // POOL: compact images only
+enum ObjRelKind : uint32_t { R_TEXT = 1, R_RODATA = 2, R_CAP = 3 }; // operand holds a TEXT address / RODATA offset / capsule id
+enum ObjFlags : uint32_t { OBJF_COMPACT = 1 }; // TEXT uses the compact operand encoding
+struct ObjSection { uint32_t off, size; };
+struct ObjHeader {
+    char magic[4]; uint16_t version, headerSize; uint32_t fileSize, flags;
+    uint32_t nSyms, nRelocs, nCaps, reserved;
+    ObjSection sec[SEC_COUNT];
+};
+struct ObjSym { uint32_t name, nameLen, value, kind; }; // kind 0: function or entry block, value = TEXT address
+struct ObjRel { uint32_t pos, kind; };                  // pos: TEXT offset of the 32-bit operand
+struct ObjCap { uint32_t name, nameLen; };
+static_assert(sizeof(ObjHeader) == 96 && sizeof(ObjSym) == 16 && sizeof(ObjRel) == 8 && sizeof(ObjCap) == 8, "object image layout");
+static constexpr char kObjMagic[4] = { 'E', 'M', 'O', 'B' };
+static constexpr uint16_t kObjVersion = 3, kObjVersionCompact = 4; // older readers reject compact images; 3/4: 64-bit EXPIRE/SLEEP
+static constexpr uint32_t kObjAlign = 64, kTextPad = 16; // pad: running off the end of TEXT hits END
+
+//
+// Compact operand encoding (--compact): the same opcodes, with variable-width operands
+//   capsule id   ULEB128 (ids below 128 take one byte, like cap8 in IrDesign.md)
+//   constant     ULEB128 of k << 1 while that fits 3 bytes, else ULEB128 of (index << 1) | 1 into the POOL section
+//                (32-bit values, each stored once)
+//   target       SLEB128 displacement from the start of the instruction; field widths are relaxed to a fixed point
+//   UN/BIN operator and SPAWN argc stay one byte. Relocs name the first byte of a field; a pooled constant's field
+//   holds its pool index.
+//
+enum OpField : uint8_t { F_CAP, F_K, F_TGT };
+static inline OpField op_field(uint8_t op, size_t i) { return 1 + 4 * i == op_target(op) ? F_TGT : (int)i < op_caps(op) ? F_CAP : F_K; }
+
+static inline size_t uleb_len(uint32_t v) { size_t n = 1; while (v >= 0x80) { v >>= 7; n++; } return n; }
+static inline size_t sleb_len(int64_t v) { size_t n = 1; while (v < -64 || v > 63) { v >>= 7; n++; } return n; }
+static inline void put_uleb(vector<uint8_t>& o, uint32_t v) { while (v >= 0x80) { o.push_back((uint8_t)(v | 0x80)); v >>= 7; } o.push_back((uint8_t)v); }
+// Writes v in exactly n >= sleb_len(v) bytes; the extra bytes only carry the sign.
+static inline void put_sleb(vector<uint8_t>& o, int64_t v, size_t n) {
+    for (size_t i = 1; i < n; i++) { o.push_back((uint8_t)((v & 0x7F) | 0x80)); v >>= 7; }
+    o.push_back((uint8_t)(v & 0x7F));
+}
+// Per-operand helpers of the VM loop; left to itself GCC stops inlining them into the larger (compact) instantiation.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define EMINOR_INLINE __forceinline
+#else
+#define EMINOR_INLINE inline __attribute__((always_inline))
+#endif
+// Value and byte length of the field at p. Both readers stop after 5 bytes, so a bad field cannot run past the END
+// padding of TEXT.
+struct Leb { uint32_t v, n; };
+static EMINOR_INLINE Leb rd_uleb(const uint8_t* p) {
+    if (p[0] < 0x80) return { p[0], 1 };
+    uint32_t v = p[0] & 0x7F, n = 1;
+    for (unsigned s = 7; s < 35; s += 7) { uint8_t b = p[n++]; v |= (uint32_t)(b & 0x7F) << s; if (b < 0x80) break; }
+    return { v, n };
+}
+static EMINOR_INLINE Leb rd_sleb(const uint8_t* p) {
+    if (p[0] < 0x80) return { (uint32_t)p[0] - (p[0] & 0x40 ? 0x80u : 0u), 1 };
+    uint32_t v = 0, n = 0; unsigned s = 0; uint8_t b;
+    do { b = p[n++]; v |= (uint32_t)(b & 0x7F) << s; s += 7; } while (b >= 0x80 && s < 35);
+    if (s < 32 && (b & 0x40)) v |= ~0u << s;
+    return { v, n };
+}
+
+struct CompactText {
+    vector<uint8_t> text; vector<uint32_t> pool;
+    vector<uint32_t> at;   // wide offset -> compact offset, for instruction starts and the end of text
+    vector<ObjRel> relocs; // in TEXT order
+};
+static constexpr uint32_t kInlineK = 1u << 20; // constants below this are inline (at most 3 bytes)
+
+// Re-encodes linked wide text. Every byte except the target fields has a fixed size, so the layout only needs the
+// target widths: start them at one byte and widen until every displacement fits (they only grow, so this ends).
+static CompactText compact_encode(const vector<uint8_t>& t, const vector<uint32_t>& roRefs) {
+    CompactText c; vector<uint32_t> starts; vector<int32_t> idx(t.size() + 1, -1);
+    for (size_t pc = 0; pc < t.size();) {
+        size_t n = op_len(t[pc]); if (!n || pc + n > t.size()) throw runtime_error("compact: bad code");
+        idx[pc] = (int32_t)starts.size(); starts.push_back((uint32_t)pc); pc += n;
+    }
+    size_t n = starts.size(); idx[t.size()] = (int32_t)n;
+    unordered_map<uint32_t, uint32_t> poolIdx;
+    auto kField = [&](uint32_t v) -> uint32_t {
+        if (v < kInlineK) return v << 1;
+        auto it = poolIdx.emplace(v, (uint32_t)c.pool.size()); if (it.second) c.pool.push_back(v);
+        return it.first->second << 1 | 1;
+    };
+    auto target = [&](size_t i) { return rd_u32le(&t[starts[i] + op_target(t[starts[i]])]); };
+    vector<uint32_t> fixed(n), tw(n, 0), off(n + 1, 0); // bytes besides the target field / target field width
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t* p = &t[starts[i]]; uint8_t op = *p; size_t nf = op_fields(op);
+        fixed[i] = (uint32_t)(op_len(op) - 4 * nf);
+        for (size_t f = 0; f < nf; f++) {
+            uint32_t v = rd_u32le(p + 1 + 4 * f);
+            switch (op_field(op, f)) {
+            case F_CAP: fixed[i] += (uint32_t)uleb_len(v); break;
+            case F_K: fixed[i] += (uint32_t)uleb_len(kField(v)); break;
+            case F_TGT: if (v > t.size() || idx[v] < 0) throw runtime_error("compact: branch into an instruction"); tw[i] = 1; break;
+            }
+        }
+    }
+    for (bool grew = true; grew;) {
+        grew = false;
+        for (size_t i = 0; i < n; i++) off[i + 1] = off[i] + fixed[i] + tw[i];
+        for (size_t i = 0; i < n; i++) {
+            if (!tw[i]) continue;
+            size_t need = sleb_len((int64_t)off[idx[target(i)]] - off[i]);
+            if (need > tw[i]) { tw[i] = (uint32_t)need; grew = true; }
+        }
+    }
+    c.at.assign(t.size() + 1, 0); for (size_t i = 0; i < n; i++) c.at[starts[i]] = off[i];
+    c.at[t.size()] = off[n];
+    unordered_set<uint32_t> ro(roRefs.begin(), roRefs.end()); c.text.reserve(off[n]);
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t* p = &t[starts[i]]; uint8_t op = *p; size_t nf = op_fields(op);
+        c.text.push_back(op);
+        for (size_t f = 0; f < nf; f++) {
+            uint32_t v = rd_u32le(p + 1 + 4 * f), pos = (uint32_t)c.text.size();
+            switch (op_field(op, f)) {
+            case F_CAP: put_uleb(c.text, v); if (v) c.relocs.push_back({ pos, R_CAP }); break;
+            case F_K: put_uleb(c.text, kField(v)); if (ro.count(starts[i] + 1 + 4 * (uint32_t)f)) c.relocs.push_back({ pos, R_RODATA }); break;
+            case F_TGT: put_sleb(c.text, (int64_t)off[idx[v]] - off[i], tw[i]); c.relocs.push_back({ pos, R_TEXT }); break;
+            }
+        }
+        c.text.insert(c.text.end(), p + 1 + 4 * nf, p + op_len(op));
+    }
+    return c;
+}
+
+static string obj_image(const Emitter::BuildResult& br, bool compact = false) {
+    string strs; auto addStr = [&](const string& n) { uint32_t o = (uint32_t)strs.size(); strs += n; strs.push_back('\0'); return o; };
+    vector<pair<string, uint32_t>> syms(br.syms.begin(), br.syms.end()); sort(syms.begin(), syms.end());
+    vector<ObjSym> st; for (auto& kv : syms) st.push_back({ addStr(kv.first), (uint32_t)kv.first.size(), kv.second, 0 });
+    vector<ObjCap> ct; for (auto& n : br.capNames) ct.push_back({ addStr(n), (uint32_t)n.size() });
+    vector<ObjRel> rt; CompactText cc; const vector<uint8_t>& t = compact ? cc.text : br.text;
+    if (compact) {
+        cc = compact_encode(br.text, br.roRefs); rt = move(cc.relocs);
+        for (auto& y : st) y.value = cc.at[y.value];
+    }
+    else {
+        for (size_t pc = 0; pc < t.size();) {
+            uint8_t op = t[pc]; size_t len = op_len(op); if (!len || pc + len > t.size()) break;
+            if (size_t o = op_target(op)) rt.push_back({ (uint32_t)(pc + o), R_TEXT });
+            for (int k = 0; k < op_caps(op); k++) if (rd_u32le(&t[pc + 1 + 4 * k])) rt.push_back({ (uint32_t)(pc + 1 + 4 * k), R_CAP }); // id 0 is not a capsule
+            pc += len;
+        }
+        for (uint32_t r : br.roRefs) rt.push_back({ r, R_RODATA });
+        sort(rt.begin(), rt.end(), [](const ObjRel& a, const ObjRel& b) { return a.pos < b.pos; });
+    }
+
+    ObjHeader h{}; memcpy(h.magic, kObjMagic, 4); h.version = compact ? kObjVersionCompact : kObjVersion; h.headerSize = sizeof(ObjHeader);
+    h.flags = compact ? (uint32_t)OBJF_COMPACT : 0;
+    h.nSyms = (uint32_t)st.size(); h.nRelocs = (uint32_t)rt.size(); h.nCaps = (uint32_t)ct.size();
+    string img(sizeof(ObjHeader), '\0');
+    auto put = [&](ObjSec k, const void* p, size_t n, size_t pad = 0) {
+        img.resize((img.size() + kObjAlign - 1) / kObjAlign * kObjAlign, '\0');
+        h.sec[k] = { (uint32_t)img.size(), (uint32_t)n }; if (n) img.append((const char*)p, n); img.append(pad, (char)OP_END);
+    };
+    put(SEC_TEXT, t.data(), t.size(), kTextPad);
+    put(SEC_DATA, nullptr, 0);
+    put(SEC_RODATA, br.rodata.data(), br.rodata.size());
+    put(SEC_SYMS, st.data(), st.size() * sizeof(ObjSym));
+    put(SEC_RELOCS, rt.data(), rt.size() * sizeof(ObjRel));
+    put(SEC_CAPS, ct.data(), ct.size() * sizeof(ObjCap));
+    put(SEC_STRS, strs.data(), strs.size());
+    if (compact) { string pool; for (uint32_t v : cc.pool) pool += u32le(v); put(SEC_POOL, pool.data(), pool.size()); }
+    h.fileSize = (uint32_t)img.size(); memcpy(&img[0], &h, sizeof h);
+    return img;
+}
+
+// Read-only view of an a.emo file: mmap'd on POSIX (read into memory elsewhere). Validation is O(symbols + capsules);
+// TEXT is executed straight from the mapping.
+struct ObjImage {
+    const uint8_t* base = nullptr; size_t size = 0; vector<uint8_t> buf; void* map = nullptr;
+
+    explicit ObjImage(const string& path) {
+#if !defined(_WIN32)
+        int fd = ::open(path.c_str(), O_RDONLY); if (fd < 0) throw runtime_error("cannot open: " + path);
+        struct stat sb; if (fstat(fd, &sb) != 0) { ::close(fd); throw runtime_error("cannot stat: " + path); }
+        size = (size_t)sb.st_size;
+        if (size) { map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0); if (map == MAP_FAILED) map = nullptr; }
+        ::close(fd);
+        if (size && !map) throw runtime_error("cannot map: " + path);
+        base = (const uint8_t*)map;
+#else
+        string s = read_file(path); buf.assign(s.begin(), s.end()); base = buf.data(); size = buf.size();
+#endif
+        try { validate(path); } catch (...) { unmap(); throw; }
+    }
+    // An image built in memory (eminor::compile); name only labels errors.
+    ObjImage(string_view bytes, const string& name) : buf(bytes.begin(), bytes.end()) {
+        base = buf.data(); size = buf.size(); validate(name);
+    }
+    ~ObjImage() { unmap(); }
+    ObjImage(const ObjImage&) = delete; ObjImage& operator=(const ObjImage&) = delete;
+    void unmap() {
+#if !defined(_WIN32)
+        if (map) munmap(map, size);
+#endif
+        map = nullptr;
+    }
+
+    const ObjHeader& hdr() const { return *(const ObjHeader*)base; }
+    const uint8_t* sec(ObjSec k) const { return base + hdr().sec[k].off; }
+    uint32_t secSize(ObjSec k) const { return hdr().sec[k].size; }
+    const ObjSym* syms() const { return (const ObjSym*)sec(SEC_SYMS); }
+    const ObjRel* relocs() const { return (const ObjRel*)sec(SEC_RELOCS); }
+    const ObjCap* caps() const { return (const ObjCap*)sec(SEC_CAPS); }
+    bool compact() const { return hdr().flags & OBJF_COMPACT; }
+    string_view str(uint32_t off, uint32_t len) const { return string_view((const char*)sec(SEC_STRS) + off, len); }
+    string_view symName(const ObjSym& y) const { return str(y.name, y.nameLen); }
+    string_view capName(uint32_t id) const { return str(caps()[id].name, caps()[id].nameLen); }
+    const ObjSym* find(string_view name) const {
+        const ObjSym* b = syms(), * e = b + hdr().nSyms;
+        auto it = lower_bound(b, e, name, [&](const ObjSym& y, string_view n) { return symName(y) < n; });
+        return it != e && symName(*it) == name ? it : nullptr;
+    }
+
+    void validate(const string& path) const {
+        auto bad = [&](const char* m) { throw runtime_error("bad object image " + path + ": " + m); };
+        const uint16_t one = 1; if (*(const uint8_t*)&one != 1) bad("big-endian hosts are not supported");
+        if (size < sizeof(ObjHeader) || memcmp(hdr().magic, kObjMagic, 4) != 0) bad("not an a.emo file");
+        if (hdr().version != (compact() ? kObjVersionCompact : kObjVersion) || hdr().headerSize != sizeof(ObjHeader)) bad("unsupported version");
+        if (hdr().fileSize != size) bad("truncated");
+        for (uint32_t k = 0; k < SEC_COUNT; k++) {
+            const ObjSection& x = hdr().sec[k];
+            if (x.off % 4 || (uint64_t)x.off + x.size + (k == SEC_TEXT ? kTextPad : 0) > size) bad("section out of range");
+        }
+        if (secSize(SEC_SYMS) != (uint64_t)hdr().nSyms * sizeof(ObjSym) || secSize(SEC_RELOCS) != (uint64_t)hdr().nRelocs * sizeof(ObjRel) ||
+            secSize(SEC_CAPS) != (uint64_t)hdr().nCaps * sizeof(ObjCap) || hdr().nCaps == 0 || secSize(SEC_POOL) % 4) bad("table size mismatch");
+        for (uint32_t i = 0; i < kTextPad; i++) if (sec(SEC_TEXT)[secSize(SEC_TEXT) + i] != OP_END) bad("text not END-padded");
+        auto nameOk = [&](uint32_t o, uint32_t n) { return (uint64_t)o + n < secSize(SEC_STRS); };
+        for (uint32_t i = 0; i < hdr().nSyms; i++) {
+            const ObjSym& y = syms()[i];
+            if (!nameOk(y.name, y.nameLen) || y.value > secSize(SEC_TEXT)) bad("symbol out of range");
+            if (i && !(symName(syms()[i - 1]) < symName(y))) bad("symbols not sorted");
+        }
+        for (uint32_t i = 0; i < hdr().nCaps; i++) if (!nameOk(caps()[i].name, caps()[i].nameLen)) bad("capsule name out of range");
+    }
+};
+
+//
+// Template JIT (--jit, x86-64 System V): hot loops of the VM run as native code
+//   A backward jump counts toward its target; after kJitHot of them the loop [target, jump] is compiled once by
+//   copying a short machine-code stencil per instruction with its operand-stack slot, capsule offset or constant
+//   patched in. Branches inside the loop become rel32 jumps between stencils; any other target, and every
+//   instruction without a stencil (calls, channels, tasks, timers, ...), is a side exit: a stub stores the pc and
+//   stack depth and returns, and the interpreter carries on from there. It re-executes the instruction it exited
+//   on, so traps (division by zero, bad ids) and blocking behave exactly as interpreted. Stack depths are static
+//   within a loop, so operand-stack values live at fixed offsets in the task's own stack and no stack pointer is
+//   kept. Registers: rbx = JitCtx, r12 = operand stack at the loop's entry depth, r13 = capsules, r14d = fuel;
+//   rax still holds the capsule an instruction just loaded or stored when the next one is not a branch target.
+//
+#ifndef EMINOR_JIT
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_WIN32)
+#define EMINOR_JIT 1
+#else
+#define EMINOR_JIT 0
+#endif
+#endif
+
+// In/out block of one native loop run; pc/depth say where the interpreter resumes.
+struct JitCtx { long long* sp; void* caps; void* vm; uint32_t fuel, pc, depth, pad; void* w; };
+typedef void (*JitFn)(JitCtx*);
+
+// Stencils: fixed byte sequences with the 32-bit holes filled in as they are copied.
+struct X64 {
+    enum Reg : uint8_t { RAX = 0, RCX = 1, RDX = 2, RSI = 6 };
+    enum Cc : uint8_t { CC_E = 4, CC_NE = 5, CC_BE = 6, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF }; // cc ^ 1 negates
+    static uint8_t ccOf(uint8_t cmp) { static const uint8_t cc[] = { CC_E, CC_NE, CC_L, CC_G, CC_LE, CC_GE }; return cc[cmp - B_EQ]; }
+    vector<uint8_t> c;
+    void b(initializer_list<uint8_t> v) { c.insert(c.end(), v); }
+    void d32(uint32_t v) { for (int i = 0; i < 4; i++) c.push_back((uint8_t)(v >> 8 * i)); }
+    void ldS(Reg r, uint32_t disp) { b({ 0x49, 0x8B, (uint8_t)(0x84 | r << 3), 0x24 }); d32(disp); } // mov r, [r12 + disp]
+    void stS(Reg r, uint32_t disp) { b({ 0x49, 0x89, (uint8_t)(0x84 | r << 3), 0x24 }); d32(disp); } // mov [r12 + disp], r
+    void ldC(Reg r, uint32_t disp) { b({ 0x49, 0x8B, (uint8_t)(0x85 | r << 3) }); d32(disp); }       // mov r, [r13 + disp]
+    void stC(Reg r, uint32_t disp) { b({ 0x49, 0x89, (uint8_t)(0x85 | r << 3) }); d32(disp); }       // mov [r13 + disp], r
+    void imm(Reg r, uint32_t k) { b({ (uint8_t)(0xB8 | r) }); d32(k); }                              // mov r32, k (zero-extends)
+    size_t jcc(uint8_t cc) { b({ 0x0F, (uint8_t)(0x80 | cc) }); d32(0); return c.size() - 4; }     // hole of the rel32
+    size_t jmp() { b({ 0xE9 }); d32(0); return c.size() - 4; }
+    void patch(size_t hole, size_t to) { uint32_t r = (uint32_t)(to - (hole + 4)); memcpy(&c[hole], &r, 4); }
+    void prologue() { b({ 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, 0x48, 0x89, 0xFB }); } // push rbx, r12-r15; mov rbx, rdi
+    void epilogue() { b({ 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 }); }
+    // mov r12/r13/r14d, [rbx + disp8] and back
+    void ldCtx(uint8_t sp, uint8_t caps, uint8_t fuel) { b({ 0x4C, 0x8B, 0x63, sp, 0x4C, 0x8B, 0x6B, caps, 0x44, 0x8B, 0x73, fuel }); }
+    void exitStub(uint8_t pcOff, uint32_t pc, uint8_t depthOff, uint32_t depth, uint8_t fuelOff) {
+        b({ 0xC7, 0x43, pcOff }); d32(pc); b({ 0xC7, 0x43, depthOff }); d32(depth); // mov dword [rbx + off], imm32
+        b({ 0x44, 0x89, 0x73, fuelOff }); epilogue();                               // mov [rbx + fuel], r14d
+    }
+    // Capsule header after a store: unless exclusively leased, the state becomes initialized (as OP_LOAD).
+    void markInit(uint32_t hdrDisp) {
+        b({ 0x41, 0x8B, 0x8D }); d32(hdrDisp);         // mov ecx, [r13 + hdr]
+        b({ 0x83, 0xF9, 0x02, 0x74, 0x0D });           // cmp ecx, CS_LEASED; je +13
+        b({ 0x83, 0xE1, 0xFC, 0x83, 0xC9, 0x01 });     // and ecx, ~CS_MASK; or ecx, CS_INIT
+        b({ 0x41, 0x89, 0x8D }); d32(hdrDisp);         // mov [r13 + hdr], ecx
+    }
+    void call(const void* fn) { b({ 0x48, 0xB8 }); uint64_t a = (uint64_t)(uintptr_t)fn; for (int i = 0; i < 8; i++) c.push_back((uint8_t)(a >> 8 * i)); b({ 0xFF, 0xD0 }); }
+};
+
+#if EMINOR_JIT
+// Maps code read-only + executable (never writable and executable at once); nullptr on failure.
+static void* jit_map(const vector<uint8_t>& code, size_t& size) {
+    size_t pg = (size_t)sysconf(_SC_PAGESIZE); size = (code.size() + pg - 1) / pg * pg;
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0); if (p == MAP_FAILED) return nullptr;
+    memcpy(p, code.data(), code.size());
+    if (mprotect(p, size, PROT_READ | PROT_EXEC) != 0) { munmap(p, size); return nullptr; }
+    return p;
+}
+#endif
+
+//
+// VM (executes the hex-IR produced by Emitter)
+//   Dispatch:  computed goto through a 256-entry label table on GCC/Clang, switch elsewhere (MSVC).
+//   Tasks:     @main plus one lightweight task per #spawn, run by a fixed pool of threads (--threads).
+//              Each pool thread owns a Chase-Lev deque for the tasks it spawns; idle threads steal.
+//              #yield requeues on a shared FIFO, #sleep on a timer wheel; #send on a full channel, #recv on
+//              an empty one and #join park until the other side acts. #join first runs other pending tasks.
+//              A task that takes kSlice backward jumps without stopping gives way if others are waiting.
+//              Each task owns a flat capsule register file indexed by the dense ids from Interner
+//              (#call shares the caller's). Channels are global bounded rings that take the packet capsule
+//              by value and leave the sender's released. The program ends when @main does.
+//   I/O:       print/#output/#render format into a per-thread buffer that joins a shared queue whenever another
+//              task could see what was printed (end of a slice, #send, #spawn); the queue goes out in one writev.
+//              #input parses integers from a shared buffer; a task whose token has not arrived parks until an
+//              idle thread has polled stdin for it, so no pool thread sits in read().
+//   Profile:   --profile PREFIX counts opcodes and opcode pairs, samples the call stack every kProfEvery instructions
+//              and times #send/#recv waits, per pool thread; writes PREFIX.{cpu,ops,wait}.folded (collapsed stacks).
+//              Off, the only trace is the choice of dispatch table when a slice starts.
+//   Calls:     CALL pushes a return address, EXIT returns (or ends the task / program when at depth 0).
+//
+#ifndef EMINOR_VM_THREADED
+#if defined(__GNUC__) || defined(__clang__)
+#define EMINOR_VM_THREADED 1
+#else
+#define EMINOR_VM_THREADED 0
+#endif
+#endif
 
-        // Emit IR
-        Emitter em; auto build = em.build(ast);
+static inline long long now_ns() {
+    return (long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Vm {
+    // Lease header: state in the low two bits, sublease count above them. A capsule only leaves its task by
+    // #send, which moves it, so the header is never shared and LEASE..RELEASE are plain integer ops.
+    enum CapState : uint32_t { CS_UNINIT = 0, CS_INIT = 1, CS_LEASED = 2, CS_RELEASED = 3, CS_MASK = 3, CS_SUBLEASE = 4 };
+    // Rarely used capsule metadata (#stamp / #expire / #error message), allocated on first use from CapPool.
+    struct CapMeta { unsigned long long stamp = 0; long long expiry = 0; uint32_t errMsg = 0xFFFFFFFFu; CapMeta* next = nullptr; }; // expiry: steady-clock ns, 0 = none
+    struct Capsule { long long v = 0; uint32_t hdr = CS_UNINIT; CapMeta* meta = nullptr; };
+    // Slab pool of CapMeta blocks, one per pool thread. A block freed on another thread joins that thread's
+    // free list; slabs are only returned when the VM dies.
+    struct CapPool {
+        static constexpr size_t kSlab = 1024;
+        vector<unique_ptr<CapMeta[]>> slabs; size_t used = kSlab; CapMeta* freeList = nullptr;
+        CapMeta* get() {
+            CapMeta* m;
+            if (freeList) { m = freeList; freeList = m->next; }
+            else { if (used == kSlab) { slabs.emplace_back(new CapMeta[kSlab]); used = 0; } m = &slabs.back()[used++]; }
+            *m = CapMeta{}; return m;
+        }
+        void put(CapMeta* m) { m->next = freeList; freeList = m; }
+    };
+    struct Task {
+        uint32_t pc = 0, entry = 0;
+        vector<long long> stack; vector<uint32_t> calls;
+        vector<uint32_t> frames; vector<Capsule> saved; // per call: its Frame; the caller's capsules it holds (enterFrame)
+        vector<Capsule> caps;
+        Task* parent = nullptr; int widx = -1; // index of the worker declaration this task runs, -1 = none
+        atomic<uint32_t> refs{ 0 };    // 1 while running + 1 per unfinished child; recycled at 0
+        atomic<uint32_t> pending{ 0 }; // unfinished children
+        unique_ptr<atomic<uint32_t>[]> pendingBy; // unfinished children per worker declaration (allocated on first spawn)
+        atomic<bool> joinWait{ false }; // parked in #join; the next child to finish requeues it
+        uint32_t nMeta = 0; // CapMeta blocks held in caps and saved, returned in bulk when the task ends
+        long long wake = 0; Task* tnext = nullptr; // #sleep deadline (steady-clock ns), next sleeper in its wheel slot
+        long long parkAt = 0; // --profile: when it parked on a channel
+    };
+    enum class Stop { Halt, Done, Yield, Block };
+
+    // Chase-Lev work-stealing deque: the owning thread pushes/pops at the bottom, thieves take from the top.
+    // Retired rings are kept until the deque dies, so a thief never reads freed memory.
+    struct WsDeque {
+        struct Ring {
+            int64_t mask; unique_ptr<atomic<Task*>[]> a;
+            explicit Ring(int64_t cap) : mask(cap - 1), a(new atomic<Task*>[(size_t)cap]) {}
+            Task* get(int64_t i) const { return a[(size_t)(i & mask)].load(memory_order_relaxed); }
+            void put(int64_t i, Task* t) { a[(size_t)(i & mask)].store(t, memory_order_relaxed); }
+        };
+        atomic<int64_t> top{ 0 }, bottom{ 0 }; atomic<Ring*> ring; vector<unique_ptr<Ring>> rings;
+        WsDeque() { rings.push_back(make_unique<Ring>(256)); ring.store(rings.back().get(), memory_order_relaxed); }
+        void push(Task* t) {
+            int64_t b = bottom.load(memory_order_relaxed), tp = top.load(memory_order_acquire);
+            Ring* r = ring.load(memory_order_relaxed);
+            if (b - tp > r->mask) {
+                rings.push_back(make_unique<Ring>((r->mask + 1) * 2)); Ring* g = rings.back().get();
+                for (int64_t i = tp; i < b; i++) g->put(i, r->get(i));
+                ring.store(g, memory_order_release); r = g;
+            }
+            r->put(b, t); bottom.store(b + 1, memory_order_release);
+        }
+        Task* pop() {
+            int64_t b = bottom.load(memory_order_relaxed) - 1; Ring* r = ring.load(memory_order_relaxed);
+            bottom.store(b, memory_order_relaxed); atomic_thread_fence(memory_order_seq_cst);
+            int64_t tp = top.load(memory_order_relaxed);
+            if (tp > b) { bottom.store(b + 1, memory_order_relaxed); return nullptr; }
+            Task* t = r->get(b);
+            if (tp == b) { // last element: race the thieves for it
+                if (!top.compare_exchange_strong(tp, tp + 1, memory_order_seq_cst, memory_order_relaxed)) t = nullptr;
+                bottom.store(b + 1, memory_order_relaxed);
+            }
+            return t;
+        }
+        Task* steal() {
+            int64_t tp = top.load(memory_order_acquire); atomic_thread_fence(memory_order_seq_cst);
+            int64_t b = bottom.load(memory_order_acquire);
+            if (tp >= b) return nullptr;
+            Task* t = ring.load(memory_order_acquire)->get(tp);
+            return top.compare_exchange_strong(tp, tp + 1, memory_order_seq_cst, memory_order_relaxed) ? t : nullptr;
+        }
+    };
+    // Profile counters of one pool thread. last: the opcode before, -1 at the start of a slice.
+    struct Prof {
+        uint64_t ops[256] = {}, pairs[256][256] = {}; int last = -1; uint32_t tick = 0;
+        unordered_map<string, uint64_t> cpu, wait; string key; // collapsed stack -> samples / wait ns
+    };
+    static constexpr uint32_t kProfEvery = 1024;
+    // One per pool thread; index 0 is the thread that called run().
+    struct Worker {
+        size_t id; WsDeque dq; uint32_t rng, tick = 0; unsigned depth = 0; // depth: nested #join helping
+        vector<unique_ptr<Task>> owned; vector<Task*> freeList; // task storage lives until the VM dies
+        CapPool meta; vector<Task*> due; // sleepers taken off the timer wheel in one batch
+        string obuf; // formatted output not yet handed to the shared queue
+        unique_ptr<Prof> prof; // --profile only
+        explicit Worker(size_t i) : id(i), rng(0x9E3779B9u * (uint32_t)(i + 1)) {}
+    };
+    // Tasks parked on one side of a channel. n mirrors ts.size() so the other side can skip the lock.
+    struct WaitList { mutex m; deque<Task*> ts; atomic<size_t> n{ 0 }; };
+    // Bounded channel: a ring of sequence-numbered slots (Vyukov MPMC). head/tail sit on their own cache lines.
+    // sp/sc are set before the pool starts when only one task can ever send/receive on the channel
+    // (see planChannels); that side then owns its index and skips the CAS.
+    struct Chan {
+        struct Slot { atomic<size_t> seq{ 0 }; Capsule c; };
+        alignas(64) atomic<size_t> head{ 0 }; // next slot to take
+        alignas(64) atomic<size_t> tail{ 0 }; // next slot to fill
+        alignas(64) unique_ptr<Slot[]> ring; size_t mask = 0; bool sp = false, sc = false;
+        WaitList recvq, sendq;
+        void open(size_t cap) { ring.reset(new Slot[cap]); mask = cap - 1; for (size_t i = 0; i < cap; i++) ring[i].seq.store(i, memory_order_relaxed); }
+        // Claims the next position on one side; false when the slot there is not ready (full / empty).
+        static bool claim(atomic<size_t>& idx, bool single, Slot* ring, size_t mask, size_t lag, size_t& pos) {
+            pos = idx.load(memory_order_relaxed);
+            for (;;) {
+                intptr_t d = (intptr_t)(ring[pos & mask].seq.load(memory_order_acquire) - (pos + lag));
+                if (d < 0) return false;
+                if (single) { idx.store(pos + 1, memory_order_relaxed); return true; } // only this task moves idx
+                if (d == 0) { if (idx.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) return true; }
+                else pos = idx.load(memory_order_relaxed);
+            }
+        }
+        bool tryPush(const Capsule& v) {
+            size_t pos; if (!claim(tail, sp, ring.get(), mask, 0, pos)) return false;
+            Slot& s = ring[pos & mask]; s.c = v; s.seq.store(pos + 1, memory_order_release); return true;
+        }
+        bool tryPop(Capsule& v) {
+            size_t pos; if (!claim(head, sc, ring.get(), mask, 1, pos)) return false;
+            Slot& s = ring[pos & mask]; v = s.c; s.seq.store(pos + mask + 1, memory_order_release); return true;
+        }
+        bool empty() const { size_t p = head.load(memory_order_acquire); return (intptr_t)(ring[p & mask].seq.load(memory_order_acquire) - (p + 1)) < 0; }
+        bool full() const { size_t p = tail.load(memory_order_acquire); return (intptr_t)(ring[p & mask].seq.load(memory_order_acquire) - p) < 0; }
+    };
 
-        // Optimize
-        Optimizer::peephole(build.text);
+    // Hierarchical timer wheel of sleeping tasks: kLevels levels of 64 slots, a level-l slot spanning 64^l ticks of
+    // 2^kTickShift ns (about 65 us). A task goes into the lowest level whose slot the wheel has not reached yet, so
+    // adding is O(1) whatever the number of sleepers; when the wheel reaches a slot above level 0 its tasks move
+    // down, and a level-0 slot is due as a whole. Deadlines round up to a tick, so nobody wakes early.
+    struct TimerWheel {
+        static constexpr unsigned kTickShift = 16, kBits = 6, kLevels = 8; // 8 x 6 bits of ticks cover any deadline
+        uint64_t cur = 0; // next tick to process
+        Task* slot[kLevels][64] = {}; uint64_t occ[kLevels] = {};
+        void add(Task* t) {
+            uint64_t k = max<uint64_t>(((uint64_t)t->wake + (1ull << kTickShift) - 1) >> kTickShift, cur); unsigned l = 0;
+            while (l + 1 < kLevels && k >> (kBits * (l + 1)) != cur >> (kBits * (l + 1))) l++;
+            unsigned i = (unsigned)(k >> (kBits * l)) & 63;
+            t->tnext = slot[l][i]; slot[l][i] = t; occ[l] |= 1ull << i;
+        }
+        // First tick at which a slot is due or moves down; ~0 when the wheel is empty.
+        uint64_t next() const {
+            uint64_t best = ~0ull;
+            for (unsigned l = 0; l < kLevels; l++) {
+                unsigned sh = kBits * l; uint64_t m = occ[l] & (~0ull << ((cur >> sh) & 63)); if (!m) continue;
+                uint64_t k = (cur >> (sh + kBits) << (sh + kBits)) | (uint64_t)ctz64(m) << sh;
+                best = min(best, max(k, cur));
+            }
+            return best;
+        }
+        long long wakeNs() const { uint64_t k = next(); return k == ~0ull ? 0 : (long long)max<uint64_t>(1, k << kTickShift); }
+        // Runs the wheel through tick upTo and appends the tasks that became due.
+        void advance(uint64_t upTo, vector<Task*>& due) {
+            for (uint64_t k; (k = next()) <= upTo; cur++) {
+                cur = k;
+                for (unsigned l = kLevels - 1; l > 0; l--) { // slots the wheel is now inside, top level first
+                    unsigned i = (unsigned)(cur >> (kBits * l)) & 63; if (!(occ[l] >> i & 1)) continue;
+                    Task* t = slot[l][i]; slot[l][i] = nullptr; occ[l] &= ~(1ull << i);
+                    for (Task* nx; t; t = nx) { nx = t->tnext; add(t); }
+                }
+                unsigned i = (unsigned)cur & 63; if (!(occ[0] >> i & 1)) continue;
+                for (Task* t = slot[0][i]; t; t = t->tnext) due.push_back(t);
+                slot[0][i] = nullptr; occ[0] &= ~(1ull << i);
+            }
+        }
+    };
+
+    static constexpr size_t kMaxStack = 1u << 20, kMaxCalls = 1u << 16;
+    static constexpr uint32_t kSlice = 1u << 16;    // backward jumps before a task checks for a stop / gives way to waiting tasks
+    static constexpr unsigned kMaxHelpDepth = 64;   // nested task slices run by one thread while it waits in #join
+    static constexpr unsigned kInjectEvery = 61;    // look at the yield queue first every Nth pick so it cannot starve
+    static constexpr size_t kChanCap = 1024;        // slots per channel (power of two); #send parks when full
+
+    const uint8_t* code = nullptr; size_t textSize = 0; const uint8_t* rodata = nullptr; size_t rodataSize = 0; // END-padded text
+    bool compact = false; const uint8_t* pool = nullptr; size_t nPool = 0; // compact operand encoding, its constant pool
+    vector<uint8_t> ownCode, ownRodata, ownPool; // backing store when built in-process; an ObjImage mapping otherwise
+    unordered_map<string, uint32_t> syms; size_t nCaps = 0;
+    unordered_map<uint32_t, int> widxOfEntry; vector<int> widxOfCap; size_t nWorkerDecls = 0; // worker declarations (JOIN operand)
+    vector<Chan> chans; // indexed by capsule id; only ids used as a SEND/RECV channel get a ring
+    vector<unique_ptr<Worker>> workers; Task* root = nullptr;
+    mutex injMu; deque<Task*> injected; atomic<size_t> nInjected{ 0 };   // yielded tasks, FIFO across the pool
+    mutex timMu; TimerWheel timers; atomic<long long> nextWake{ 0 }; // sleepers; nextWake: when the wheel next needs a turn
+    atomic<size_t> nParked{ 0 };           // blocked on #send/#recv/#join
+    atomic<size_t> live{ 0 };              // spawned and not yet finished
+    mutex idleMu; condition_variable idleCv; atomic<unsigned> nIdle{ 0 };
+    atomic<bool> stopping{ false }; mutex errMu; exception_ptr failure;
+    atomic<long long> maxErr{ 0 };
+    mutex ioMu; ostream& out; istream& in;
+    // Under ioMu. outFd/inFd are the descriptors behind cout/cin (-1: another stream, written/read through it).
+    static constexpr size_t kOutBatch = 1u << 16, kOutChunks = 64; // queue bytes / buffers that trigger a write
+    int outFd = -1, inFd = -1; bool outTty = false;
+    vector<string> outq, spare; size_t outqBytes = 0;
+    string inBuf; size_t inPos = 0; bool inEof = false;
+    WaitList inq; atomic<bool> inPolling{ false }; // tasks waiting in #input; a thread is polling stdin
+#if EMINOR_VM_THREADED
+    void* jt[4][256]; // wide, compact; the same two counting each instruction first (--profile)
+#endif
+    bool jit = false; // --jit: run hot loops as native code (see Template JIT; x86-64 only, ignored elsewhere)
+    string profile;   // --profile PREFIX (turns the JIT off: native loops would not be counted)
+    vector<string> capNames; // by id, for the channel names in a profile
+    vector<pair<uint32_t, string>> funcs; // (start, name) by start, one name per address
+    using Host = eminor::Host; // see eminor.h: CALL hands it the top argc stack values and pops them
+    unordered_map<uint32_t, Host> hosts; // by TEXT address
+    // A called function's parameters and locals (frameCaps[first, first + n), see planFrames): CALL saves them and
+    // its EXIT puts them back, so they are per call and a callee never clobbers its caller's. Frame 0 is empty.
+    struct Frame { uint32_t first = 0, n = 0; };
+    vector<Frame> frameList{ Frame{} }; vector<uint32_t> frameCaps, frameAt; // frameAt: frame by entry pc (a flat table: CALL is hot)
+#if EMINOR_JIT
+    struct JitRegion { JitFn fn = nullptr; void* mem = nullptr; size_t size = 0; uint32_t maxDepth = 0; };
+    // hot[pc] of a backward-jump target: a count below kJitHot, compiling (kJitHot), kJitBase + region, or kJitNone
+    static constexpr uint32_t kJitHot = 64, kJitBase = 1u << 31, kJitNone = ~0u;
+    static constexpr size_t kJitMaxRegions = 4096, kJitMaxInsns = 4096;
+    unique_ptr<atomic<uint32_t>[]> hot; unique_ptr<JitRegion[]> regions; size_t nRegions = 0; mutex jitMu;
+#endif
+
+    // compactCode re-encodes the text first (as --compact images are), to run that form in-process.
+    Vm(const Emitter::BuildResult& br, bool compactCode = false, ostream& o = cout, istream& i = cin)
+        : ownCode(br.text), ownRodata(br.rodata), syms(br.syms), nCaps(br.capNames.size()), widxOfCap(br.capNames.size(), -1), chans(br.capNames.size()), out(o), in(i), capNames(br.capNames) {
+        if (compactCode) {
+            CompactText c = compact_encode(br.text, br.roRefs); ownCode = move(c.text);
+            for (uint32_t v : c.pool) { string b = u32le(v); ownPool.insert(ownPool.end(), b.begin(), b.end()); }
+            for (auto& kv : syms) kv.second = c.at[kv.second];
+            compact = true; pool = ownPool.data(); nPool = c.pool.size();
+        }
+        textSize = ownCode.size();
+        ownCode.insert(ownCode.end(), kTextPad, (uint8_t)OP_END); // sentinel: running off the end or reading past it halts
+        code = ownCode.data(); rodata = ownRodata.data(); rodataSize = ownRodata.size();
+        for (uint32_t id = 1; id < br.capNames.size(); id++) bindWorker(id, br.capNames[id]);
+        init();
+    }
+    // Runs the image in place; img must outlive the Vm.
+    Vm(const ObjImage& img, ostream& o = cout, istream& i = cin)
+        : code(img.sec(SEC_TEXT)), textSize(img.secSize(SEC_TEXT)), rodata(img.sec(SEC_RODATA)), rodataSize(img.secSize(SEC_RODATA)),
+        nCaps(img.hdr().nCaps), widxOfCap(img.hdr().nCaps, -1), chans(img.hdr().nCaps), out(o), in(i) {
+        compact = img.compact(); pool = img.sec(SEC_POOL); nPool = img.secSize(SEC_POOL) / 4;
+        for (uint32_t k = 0; k < img.hdr().nSyms; k++) syms.emplace(string(img.symName(img.syms()[k])), img.syms()[k].value);
+        for (uint32_t id = 1; id < nCaps; id++) bindWorker(id, img.capName(id));
+        capNames.resize(nCaps); for (uint32_t id = 1; id < nCaps; id++) capNames[id] = img.capName(id);
+        init();
+    }
+#if EMINOR_JIT
+    ~Vm() { for (size_t i = 0; i < nRegions; i++) munmap(regions[i].mem, regions[i].size); }
+#endif
+    // A capsule named like a function is a worker declaration (the JOIN operand for tasks spawned at that entry).
+    void bindWorker(uint32_t id, string_view name) {
+        auto it = syms.find(string(name)); if (it == syms.end()) return;
+        auto [w, fresh] = widxOfEntry.emplace(it->second, (int)nWorkerDecls); // an imported worker can have two names
+        if (fresh) nWorkerDecls++;
+        widxOfCap[id] = w->second;
+    }
+    void init() {
+#if !defined(_WIN32)
+        if (&out == &cout) { outFd = STDOUT_FILENO; outTty = isatty(outFd); }
+        if (&in == &cin) inFd = STDIN_FILENO;
+#endif
+#if EMINOR_VM_THREADED
+        exec<false>(nullptr, nullptr); exec<true>(nullptr, nullptr); // fill jt
+#endif
+    }
+
+    // A compact constant field: an inline value or a pool index.
+    EMINOR_INLINE uint32_t poolK(uint32_t x, const uint8_t* at) {
+        if (!(x & 1)) return x >> 1;
+        if ((x >> 1) >= nPool) trap(at, "constant pool index out of range");
+        return rd_u32le(pool + 4 * (size_t)(x >> 1));
+    }
+    // One instruction of either encoding: its 32-bit fields in wide order (targets as TEXT offsets) and its length.
+    struct OpDec { uint8_t op; uint32_t f[3]; uint32_t len; };
+    bool decodeAt(size_t pc, OpDec& d) {
+        d.op = code[pc]; size_t n = op_len(d.op), nf = op_fields(d.op); if (!n) return false;
+        if (!compact) {
+            for (size_t i = 0; i < nf; i++) d.f[i] = rd_u32le(&code[pc + 1 + 4 * i]);
+            d.len = (uint32_t)n; return pc + n <= textSize;
+        }
+        const uint8_t* p = code + pc + 1;
+        for (size_t i = 0; i < nf; i++) {
+            switch (op_field(d.op, i)) {
+            case F_CAP: { Leb l = rd_uleb(p); d.f[i] = l.v; p += l.n; break; }
+            case F_K: { Leb l = rd_uleb(p); if ((l.v & 1) && (l.v >> 1) >= nPool) return false; d.f[i] = poolK(l.v, p); p += l.n; break; }
+            case F_TGT: { Leb l = rd_sleb(p); d.f[i] = (uint32_t)pc + l.v; p += l.n; break; }
+            }
+        }
+        p += n - 1 - 4 * nf; d.len = (uint32_t)(p - (code + pc)); return pc + d.len <= textSize;
+    }
+    static uint32_t targetOf(const OpDec& d) { size_t o = op_target(d.op); return o ? d.f[(o - 1) / 4] : 0; }
+
+    [[noreturn]] void trap(const uint8_t* at, const string& m) {
+        throw runtime_error("vm trap @" + to_string((size_t)(at - code)) + ": " + m);
+    }
+
+    // False when the image has no symbol name (nothing calls it).
+    bool bindHost(const string& name, Host h) {
+        auto it = syms.find(name); if (it == syms.end()) return false;
+        hosts[it->second] = move(h); return true;
+    }
+    void callHost(Task& t, const Host& h, const uint8_t* at) {
+        auto& st = t.stack; if (st.size() < h.argc) trap(at, "operand stack underflow");
+        long long r = h.fn(st.data() + st.size() - h.argc, h.argc);
+        st.resize(st.size() - h.argc);
+        if (h.ret) { if (st.size() >= kMaxStack) trap(at, "operand stack overflow"); st.push_back(r); }
+    }
+
+    uint32_t entryOf(const string& name) const {
+        auto it = syms.find(name); if (it != syms.end()) return it->second;
+        it = syms.find("@entry_point"); if (name == "@main" && it != syms.end()) return it->second;
+        throw runtime_error("vm: no entry symbol " + name);
+    }
+
+    // TEXT decoded once for the planning passes; ix: instruction index at a pc, kNoInsn inside or past one.
+    static constexpr uint32_t kNoInsn = ~0u - 1;
+    struct Listing { vector<uint32_t> starts; vector<OpDec> ops; vector<uint32_t> ix; };
+    Listing listing() {
+        Listing l; l.ix.assign(textSize + 1, kNoInsn);
+        for (size_t pc = 0; pc < textSize;) {
+            OpDec d; if (!decodeAt(pc, d)) break;
+            l.ix[pc] = (uint32_t)l.starts.size(); l.starts.push_back((uint32_t)pc); l.ops.push_back(d); pc += d.len;
+        }
+        return l;
+    }
+
+    // Fills frameAt for every CALL target. A frame holds the function's parameters (the LOADs its prologue starts
+    // with, popping the caller's arguments) and the capsules it writes that no other code names: its locals.
+    // Capsules named elsewhere too are shared, so a callee's effects on them (a global it updates, a packet it
+    // sends, an #init or #recv) stay. Names come from a flood of every entry (symbols, CALL and SPAWN targets)
+    // through fallthrough and jumps, not into callees. --regs temporaries are shared names, and need no saving:
+    // expressions holding a call keep the stack form, so no temporary is live across one.
+    void planFrames(const Listing& l) {
+        frameAt.assign(textSize + 1, 0);
+        auto valid = [&](uint32_t pc) { return pc < textSize && l.ix[pc] != kNoInsn; };
+        vector<uint32_t> entries; for (auto& kv : syms) if (valid(kv.second)) entries.push_back(kv.second);
+        for (const OpDec& d : l.ops) if ((d.op == OP_CALL || d.op == OP_SPAWN) && valid(targetOf(d))) entries.push_back(targetOf(d));
+        sort(entries.begin(), entries.end()); entries.erase(unique(entries.begin(), entries.end()), entries.end());
+        const uint32_t kNobody = ~0u, kShared = ~0u - 1;
+        vector<uint32_t> mark(textSize + 1, ~0u), namedBy(nCaps, kNobody), work; vector<vector<uint32_t>> written(entries.size());
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            work.assign(1, entries[i]);
+            while (!work.empty()) {
+                uint32_t pc = work.back(); work.pop_back();
+                if (!valid(pc) || mark[pc] == i) continue;
+                mark[pc] = i;
+                const OpDec& d = l.ops[l.ix[pc]]; uint8_t op = d.op;
+                for (int k = 0; k < op_caps(op); k++) {
+                    uint32_t id = d.f[k]; if (!id || id >= nCaps) continue;
+                    namedBy[id] = namedBy[id] == kNobody || namedBy[id] == i ? i : kShared;
+                }
+                if (int k = op_cap_written(op); k >= 0 && d.f[k] && d.f[k] < nCaps) written[i].push_back(d.f[k]);
+                if (op == OP_EXIT || op == OP_END) continue;
+                if (op == OP_JMP || op_cond_branch(op)) work.push_back(targetOf(d));
+                if (op != OP_JMP) work.push_back(pc + d.len);
+            }
+        }
+        vector<char> called(textSize + 1, 0); for (const OpDec& d : l.ops) if (d.op == OP_CALL && valid(targetOf(d))) called[targetOf(d)] = 1;
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            uint32_t e = entries[i]; if (!called[e] || hosts.count(e)) continue;
+            vector<uint32_t> ids;
+            for (uint32_t pc = e; valid(pc) && l.ops[l.ix[pc]].op == OP_LOAD; pc += l.ops[l.ix[pc]].len) ids.push_back(l.ops[l.ix[pc]].f[0]);
+            for (uint32_t id : written[i]) if (namedBy[id] == i) ids.push_back(id);
+            sort(ids.begin(), ids.end()); ids.erase(unique(ids.begin(), ids.end()), ids.end());
+            if (ids.empty()) continue; // frame 0
+            frameAt[e] = (uint32_t)frameList.size(); frameList.push_back({ (uint32_t)frameCaps.size(), (uint32_t)ids.size() });
+            frameCaps.insert(frameCaps.end(), ids.begin(), ids.end());
+        }
+    }
+    // CALL: the callee's capsules go to t.saved and it carries on with copies (metadata blocks too, so neither side
+    // frees the other's). EXIT undoes it.
+    void enterFrame(Worker& w, Task& t, uint32_t entry) {
+        uint32_t f = entry < frameAt.size() ? frameAt[entry] : 0; t.frames.push_back(f);
+        const Frame& fr = frameList[f];
+        for (uint32_t k = 0; k < fr.n; k++) {
+            Capsule& c = t.caps[frameCaps[fr.first + k]]; t.saved.push_back(c);
+            if (c.meta) { CapMeta* m = w.meta.get(); *m = *c.meta; m->next = nullptr; c.meta = m; t.nMeta++; }
+        }
+    }
+    void leaveFrame(Worker& w, Task& t) {
+        const Frame& fr = frameList[t.frames.back()]; t.frames.pop_back();
+        for (uint32_t k = fr.n; k-- > 0;) { Capsule& c = t.caps[frameCaps[fr.first + k]]; dropMeta(w, t, c); c = t.saved.back(); t.saved.pop_back(); }
+    }
+
+    // Opens a ring for every capsule id used as a SEND/RECV channel and picks the single-producer /
+    // single-consumer fast paths. A side is single when every instruction using it is reachable from one
+    // task entry only and that entry runs as at most one task: the root, or a worker spawned from exactly
+    // one such site that is outside every loop (range of a backward jump) and not inside a called function.
+    void planChannels(uint32_t rootEntry, const Listing& l) {
+        const uint32_t kMulti = ~0u, kNone = kNoInsn;
+        const vector<uint32_t>& starts = l.starts, & ix = l.ix; const vector<OpDec>& ops = l.ops;
+        vector<uint32_t> owner(textSize + 1, kNone); vector<uint8_t> viaCall(textSize + 1, 0);
+        vector<int> loopDepth(textSize + 2, 0); // difference array over backward-jump ranges
+        vector<uint32_t> entries{ rootEntry };
+        for (size_t i = 0; i < starts.size(); i++) {
+            uint32_t pc = starts[i]; uint8_t op = ops[i].op; if (!op_target(op)) continue;
+            uint32_t a = targetOf(ops[i]);
+            if (op == OP_SPAWN && a < textSize && ix[a] != kNone) entries.push_back(a);
+            if ((op_cond_branch(op) || op == OP_JMP) && a <= pc) { loopDepth[a]++; loopDepth[pc + 1]--; }
+        }
+        for (size_t i = 1; i < loopDepth.size(); i++) loopDepth[i] += loopDepth[i - 1];
+        sort(entries.begin(), entries.end()); entries.erase(unique(entries.begin(), entries.end()), entries.end());
+        // Flood each entry through fallthrough, jumps and calls. A location reached from a second entry becomes
+        // kMulti and so does everything after it, so a flood stops at its own or at kMulti locations.
+        for (uint32_t e : entries) {
+            vector<pair<uint32_t, bool>> work{ { e, false } };
+            while (!work.empty()) {
+                auto [pc, call] = work.back(); work.pop_back();
+                if (pc >= textSize || ix[pc] == kNone) continue;
+                if (call && !viaCall[pc]) viaCall[pc] = 1; else if (owner[pc] == e || owner[pc] == kMulti) continue;
+                owner[pc] = owner[pc] == kNone || owner[pc] == e ? e : kMulti;
+                const OpDec& d = ops[ix[pc]]; uint8_t op = d.op; uint32_t next = pc + d.len, a = targetOf(d);
+                if (op == OP_JMP) { work.push_back({ a, call }); continue; }
+                if (op == OP_EXIT || op == OP_END) continue;
+                if (op_cond_branch(op)) work.push_back({ a, call });
+                if (op == OP_CALL) work.push_back({ a, true });
+                work.push_back({ next, call });
+            }
+        }
+        // Instance counts (0, 1, 2 = many) per entry, to a fixpoint.
+        unordered_map<uint32_t, int> inst; for (uint32_t e : entries) inst[e] = 0;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (uint32_t e : entries) {
+                int n = e == rootEntry;
+                for (size_t i = 0; i < starts.size(); i++) {
+                    uint32_t pc = starts[i];
+                    if (ops[i].op != OP_SPAWN || ops[i].f[0] != e || owner[pc] == kNone) continue;
+                    n += owner[pc] == kMulti || viaCall[pc] || loopDepth[pc] ? 2 : inst[owner[pc]];
+                }
+                n = min(n, 2); if (n != inst[e]) { inst[e] = n; changed = true; }
+            }
+        }
+        vector<uint32_t> prod(chans.size(), kNone), cons(chans.size(), kNone);
+        for (size_t i = 0; i < starts.size(); i++) {
+            uint32_t pc = starts[i]; uint8_t op = ops[i].op; if (op != OP_SEND && op != OP_RECV) continue;
+            uint32_t ch = ops[i].f[0]; if (ch >= chans.size()) continue;
+            if (!chans[ch].ring) chans[ch].open(kChanCap);
+            uint32_t o = owner[pc]; if (o == kNone) continue; // unreachable
+            uint32_t& side = op == OP_SEND ? prod[ch] : cons[ch];
+            side = o == kMulti || inst[o] != 1 || (side != kNone && side != o) ? kMulti : o;
+        }
+        for (size_t ch = 0; ch < chans.size(); ch++) {
+            chans[ch].sp = prod[ch] != kNone && prod[ch] != kMulti;
+            chans[ch].sc = cons[ch] != kNone && cons[ch] != kMulti;
+        }
+    }
+
+    // Returns the process exit status: 0, or the largest #error code raised (clamped to 255).
+    // threads = 0 uses one pool thread per hardware thread.
+    int run(const string& entryName = "@main", unsigned threads = 1) {
+        if (!threads) threads = max(1u, thread::hardware_concurrency());
+        for (unsigned i = 0; i < threads; i++) workers.push_back(make_unique<Worker>(i));
+        uint32_t entry = entryOf(entryName);
+        { Listing l = listing(); planChannels(entry, l); planFrames(l); }
+#if EMINOR_JIT
+        if (jit && profile.empty() && !hot) { hot.reset(new atomic<uint32_t>[textSize]()); regions.reset(new JitRegion[kJitMaxRegions]); }
+#endif
+        timers.cur = (uint64_t)now_ns() >> TimerWheel::kTickShift;
+        if (!profile.empty()) {
+            for (auto& w : workers) w->prof = make_unique<Prof>();
+            for (auto& kv : syms) funcs.push_back({ kv.second, kv.first });
+            sort(funcs.begin(), funcs.end()); // of two names for one address ("$f", "mod::$f") the first stays
+            funcs.erase(unique(funcs.begin(), funcs.end(), [](auto& a, auto& b) { return a.first == b.first; }), funcs.end());
+        }
+        out.flush(); // what the driver printed comes before the program's output
+        root = spawn(*workers[0], entry, nullptr); workers[0]->dq.push(root);
+        vector<thread> pool;
+        for (unsigned i = 1; i < threads; i++) pool.emplace_back([this, i] { workerLoop(*workers[i]); });
+        workerLoop(*workers[0]);
+        for (auto& th : pool) th.join();
+        flushOut();
+        if (!profile.empty()) writeProfile();
+        if (failure) rethrow_exception(failure);
+        long long e = maxErr.load(); return e > 255 ? 255 : (int)e;
+    }
+
+    // Scheduler: own deque (LIFO) -> due sleepers -> yield queue (FIFO) -> steal from another deque (FIFO end).
+    void workerLoop(Worker& w) {
+        try {
+            while (!stopping.load(memory_order_acquire)) {
+                if (Task* t = findWork(w)) runSlice(w, t); else idleWait(w);
+            }
+        }
+        catch (...) {
+            handOff(w); // what ran before a trap is still printed
+            { lock_guard<mutex> lk(errMu); if (!failure) failure = current_exception(); }
+            stop();
+        }
+    }
+
+    bool othersWaiting(Worker& w) {
+        long long nw = nextWake.load(memory_order_relaxed);
+        return nInjected.load(memory_order_relaxed) || (nw && nw <= now_ns())
+            || w.dq.bottom.load(memory_order_relaxed) > w.dq.top.load(memory_order_relaxed);
+    }
+    void stop() { stopping.store(true); lock_guard<mutex> lk(idleMu); idleCv.notify_all(); }
+    void kick() { if (nIdle.load(memory_order_relaxed)) idleCv.notify_one(); }
+
+    Task* findWork(Worker& w) {
+        if (++w.tick % kInjectEvery == 0) {
+            if (inq.n.load(memory_order_relaxed) && !inPolling.exchange(true)) { pollInput(w, 0); inPolling.store(false); }
+            if (Task* t = popInjected()) return t;
+        }
+        if (Task* t = w.dq.pop()) return t;
+        if (Task* t = popDueTimer(w)) return t;
+        if (Task* t = popInjected()) return t;
+        size_t n = workers.size();
+        if (n > 1) {
+            w.rng ^= w.rng << 13; w.rng ^= w.rng >> 17; w.rng ^= w.rng << 5;
+            for (size_t k = 0; k < 2 * n; k++) { // two sweeps from a random victim; a lost race is a retry
+                Worker& v = *workers[(w.rng + k) % n];
+                if (&v != &w) if (Task* t = v.dq.steal()) return t;
+            }
+        }
+        return nullptr;
+    }
+
+    // Runs t until it stops and files it where its stop reason says.
+    void runSlice(Worker& w, Task* t) {
+        if (w.prof) { if (t->parkAt) profWait(w, *t); w.prof->last = -1; }
+        Stop s = compact ? exec<true>(t, &w) : exec<false>(t, &w);
+        handOff(w); // t may resume on another thread
+        switch (s) {
+        case Stop::Halt: stop(); break;
+        case Stop::Done: if (t == root) stop(); else finish(w, t); break;
+        case Stop::Yield: if (t->wake) addTimer(t); else inject(t); break;
+        case Stop::Block: park(w, t); break;
+        }
+    }
+
+    // With every pool thread in here no task is mid-transition, so parked == live means nothing can wake anyone.
+    // Output queued so far goes out first; one idle thread waits on stdin instead when tasks are parked in #input.
+    void idleWait(Worker& w) {
+        flushOut();
+        unique_lock<mutex> lk(idleMu);
+        if (stopping.load()) return;
+        long long d = 1000000, nw = nextWake.load(); // 1 ms also bounds a missed kick()
+        if (nw) d = min(d, max(0LL, nw - now_ns()));
+        else if (!inq.n.load() && nIdle.load() + 1 == workers.size() && nParked.load() == live.load())
+            throw runtime_error("vm: deadlock (all tasks blocked on #send/#recv/#join)");
+        if (inq.n.load() && !inPolling.exchange(true)) { lk.unlock(); pollInput(w, d); inPolling.store(false); return; }
+        nIdle++; idleCv.wait_for(lk, chrono::nanoseconds(d)); nIdle--;
+    }
+
+    Task* spawn(Worker& w, uint32_t entry, Task* parent) {
+        Task* t;
+        if (!w.freeList.empty()) { t = w.freeList.back(); w.freeList.pop_back(); }
+        else { w.owned.push_back(make_unique<Task>()); t = w.owned.back().get(); t->stack.reserve(64); }
+        t->pc = t->entry = entry; t->stack.clear(); t->calls.clear(); t->frames.clear(); t->saved.clear(); t->caps.assign(nCaps, Capsule{}); t->nMeta = 0;
+        t->wake = 0; t->parent = parent; t->refs.store(1, memory_order_relaxed);
+        auto it = widxOfEntry.find(entry); t->widx = it == widxOfEntry.end() ? -1 : it->second;
+        if (parent) {
+            parent->refs.fetch_add(1, memory_order_relaxed); parent->pending.fetch_add(1, memory_order_relaxed);
+            if (t->widx >= 0) {
+                if (!parent->pendingBy) parent->pendingBy.reset(new atomic<uint32_t>[nWorkerDecls]());
+                parent->pendingBy[t->widx].fetch_add(1, memory_order_relaxed);
+            }
+        }
+        live.fetch_add(1);
+        return t;
+    }
+
+    void release(Worker& w, Task* t) { if (t->refs.fetch_sub(1, memory_order_acq_rel) == 1) w.freeList.push_back(t); }
+
+    void finish(Worker& w, Task* t) {
+        Task* p = t->parent;
+        if (p) {
+            if (t->widx >= 0) p->pendingBy[t->widx].fetch_sub(1, memory_order_release);
+            p->pending.fetch_sub(1, memory_order_release);
+            atomic_thread_fence(memory_order_seq_cst); // pairs with parkJoin
+            if (p->joinWait.load(memory_order_relaxed) && p->joinWait.exchange(false)) { nParked.fetch_sub(1); w.dq.push(p); kick(); }
+        }
+        if (t->nMeta) {
+            for (Capsule& c : t->caps) if (c.meta) w.meta.put(c.meta);
+            for (Capsule& c : t->saved) if (c.meta) w.meta.put(c.meta); // halted inside a call
+        }
+        live.fetch_sub(1);
+        if (p) release(w, p);
+        release(w, t);
+    }
+
+    void inject(Task* t) {
+        { lock_guard<mutex> lk(injMu); injected.push_back(t); nInjected.fetch_add(1); }
+        kick();
+    }
+    Task* popInjected() {
+        if (!nInjected.load(memory_order_relaxed)) return nullptr;
+        lock_guard<mutex> lk(injMu);
+        if (injected.empty()) return nullptr;
+        Task* t = injected.front(); injected.pop_front(); nInjected.fetch_sub(1); return t;
+    }
+
+    void addTimer(Task* t) { lock_guard<mutex> lk(timMu); timers.add(t); nextWake.store(timers.wakeNs()); }
+    // Turns the wheel up to now under one lock, returns the earliest due sleeper and pushes the rest onto w's deque
+    // (latest first, so w resumes them in deadline order while idle threads steal from the other end).
+    Task* popDueTimer(Worker& w) {
+        long long nw = nextWake.load(memory_order_relaxed), now;
+        if (!nw || nw > (now = now_ns())) return nullptr;
+        auto& due = w.due; due.clear();
+        { lock_guard<mutex> lk(timMu); timers.advance((uint64_t)now >> TimerWheel::kTickShift, due); nextWake.store(timers.wakeNs()); }
+        if (due.empty()) return nullptr;
+        sort(due.begin(), due.end(), [](Task* a, Task* b) { return a->wake < b->wake; });
+        for (size_t i = due.size(); i-- > 1;) { due[i]->wake = 0; w.dq.push(due[i]); }
+        if (due.size() > 1 && nIdle.load(memory_order_relaxed)) idleCv.notify_all();
+        due[0]->wake = 0; return due[0];
+    }
 
-        // Link (single module -> just finalize blobs)
-        // Output files
-        string base = (filesystem::path(cmd.outDir) / "a").string();
-        write_file(base + ".ir.bin", string((const char*)build.text.data(), (long long)build.text.size()));
-        write_file(base + ".text.hex", dump_hex(build.text));
-        write_file(base + ".rodata.bin", string((const char*)build.rodata.data(), (long long)build.rodata.size()));
+    // A blocked task is re-checked after it announces itself, and the side that can unblock it looks for waiters
+    // after its own update (both behind a seq_cst fence): either the re-check sees the update or the notify sees the waiter.
+    void park(Worker& w, Task* t) {
+        OpDec d; decodeAt(t->pc, d); uint32_t a = d.f[0]; // the instruction already decoded (and validated the channel)
+        if (d.op == OP_JOIN) { parkJoin(w, t, a); return; }
+        if (w.prof && d.op != OP_INPUT) t->parkAt = now_ns();
+        if (d.op == OP_INPUT) { flushOut(); parkOn(w, t, inq, [&] { lock_guard<mutex> lk(ioMu); size_t p, e; return !nextToken(p, e); }); return; } // prompts go out first
+        Chan& c = chans[a];
+        if (d.op == OP_RECV) parkOn(w, t, c.recvq, [&] { return c.empty(); });
+        else parkOn(w, t, c.sendq, [&] { return c.full(); });
+    }
+    template <class Blocked> void parkOn(Worker& w, Task* t, WaitList& L, Blocked blocked) {
+        unique_lock<mutex> lk(L.m);
+        L.n.store(L.ts.size() + 1, memory_order_relaxed); atomic_thread_fence(memory_order_seq_cst);
+        if (!blocked()) { L.n.store(L.ts.size(), memory_order_relaxed); lk.unlock(); w.dq.push(t); return; }
+        L.ts.push_back(t); nParked.fetch_add(1);
+    }
+    void notify(Worker& w, WaitList& L) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!L.n.load(memory_order_relaxed)) return;
+        Task* t;
+        {
+            lock_guard<mutex> lk(L.m);
+            if (L.ts.empty()) return;
+            t = L.ts.front(); L.ts.pop_front(); L.n.store(L.ts.size(), memory_order_relaxed); nParked.fetch_sub(1);
+        }
+        w.dq.push(t); kick();
+    }
+    void parkJoin(Worker& w, Task* t, uint32_t id) {
+        nParked.fetch_add(1); t->joinWait.store(true); atomic_thread_fence(memory_order_seq_cst);
+        if (joinPending(*t, id)) return;
+        if (t->joinWait.exchange(false)) { nParked.fetch_sub(1); w.dq.push(t); } // else a finishing child took it
+    }
+
+    bool joinPending(const Task& t, uint32_t id) const {
+        int wi = id < widxOfCap.size() ? widxOfCap[id] : -1;
+        if (wi < 0) return t.pending.load(memory_order_acquire) != 0; // operand names no worker: join every child
+        return t.pendingBy && t.pendingBy[wi].load(memory_order_acquire) != 0;
+    }
+
+    // #join: instead of blocking right away, run other pending tasks on this thread until t's children are done.
+    // False when there is nothing left to help with (the caller then parks) or the pool is stopping.
+    bool helpJoin(Worker& w, Task& t, uint32_t id) {
+        bool ok = true;
+        ++w.depth;
+        for (;;) {
+            if (!joinPending(t, id)) break;
+            Task* o = w.depth > kMaxHelpDepth || stopping.load(memory_order_relaxed) ? nullptr : findWork(w);
+            if (!o) { ok = false; break; }
+            runSlice(w, o);
+        }
+        --w.depth; return ok;
+    }
+
+    void print(Worker& w, long long v) {
+        char b[24], * e = b + sizeof b, * p = e; unsigned long long u = v < 0 ? 0ull - (unsigned long long)v : (unsigned long long)v;
+        *--p = '\n'; do { *--p = (char)('0' + u % 10); u /= 10; } while (u); if (v < 0) *--p = '-';
+        w.obuf.append(p, e); if (w.obuf.size() >= kOutBatch) handOff(w);
+    }
+    // Moves w's output to the shared queue (in the order handoffs happen), writing the queue out once it is big enough.
+    void handOff(Worker& w) {
+        if (w.obuf.empty()) return;
+        lock_guard<mutex> lk(ioMu);
+        outqBytes += w.obuf.size(); outq.push_back(move(w.obuf));
+        if (!spare.empty()) { w.obuf.swap(spare.back()); spare.pop_back(); } else w.obuf.clear();
+        if (outTty || outqBytes >= kOutBatch || outq.size() >= kOutChunks) writeOut();
+    }
+    void flushOut() { lock_guard<mutex> lk(ioMu); writeOut(); }
+    // ioMu held. A write error drops the rest, as a failed ostream would.
+    void writeOut() {
+        if (outq.empty()) return;
+#if !defined(_WIN32)
+        if (outFd >= 0) {
+            size_t i = 0, off = 0; // first unwritten byte: outq[i][off]
+            while (i < outq.size()) {
+                iovec v[kOutChunks]; int n = 0;
+                for (size_t k = i, o = off; k < outq.size() && n < (int)kOutChunks; k++, o = 0) v[n++] = { (void*)(outq[k].data() + o), outq[k].size() - o };
+                ssize_t r = ::writev(outFd, v, n);
+                if (r < 0) { if (errno == EINTR) continue; break; }
+                for (size_t left = (size_t)r; left;) { size_t m = outq[i].size() - off; if (left < m) { off += left; break; } left -= m; i++; off = 0; }
+            }
+        }
+        else
+#endif
+        { for (auto& b : outq) out.write(b.data(), (streamsize)b.size()); out.flush(); }
+        for (auto& b : outq) if (spare.size() < 4 * kOutChunks) { b.clear(); spare.push_back(move(b)); }
+        outq.clear(); outqBytes = 0;
+    }
+
+    // ioMu held: the next input token as [p, e); false while it has not fully arrived.
+    bool nextToken(size_t& p, size_t& e) const {
+        size_t n = inBuf.size(); p = inPos;
+        while (p < n && isspace((unsigned char)inBuf[p])) p++;
+        for (e = p; e < n && !isspace((unsigned char)inBuf[e]); e++) {}
+        return e < n || inEof;
+    }
+    // #input: the next whitespace-separated integer (0 for a token that is not one, and at end of input).
+    // False when reading stdin and the token is not complete yet; the task then parks on inq.
+    bool readInput(long long& v) {
+        lock_guard<mutex> lk(ioMu);
+        if (inFd < 0) { if (!(in >> v)) { in.clear(); v = 0; } return true; }
+        size_t p, e; if (!nextToken(p, e)) return false;
+        inPos = e; bool neg = p < e && (inBuf[p] == '-' || inBuf[p] == '+') && inBuf[p++] == '-';
+        unsigned long long u = 0; bool ok = p < e;
+        for (; ok && p < e; p++) { if (!isdigit((unsigned char)inBuf[p])) ok = false; else u = u * 10 + (unsigned)(inBuf[p] - '0'); }
+        v = ok ? (long long)(neg ? 0ull - u : u) : 0; return true;
+    }
+    // Waits up to d ns for stdin, appends what arrived (or notes its end) and wakes the tasks parked in #input; one
+    // whose token is still incomplete parks again. Called only by the thread that set inPolling.
+    void pollInput(Worker& w, long long d) {
+#if !defined(_WIN32)
+        pollfd pf{ inFd, POLLIN, 0 };
+        if (::poll(&pf, 1, (int)((d + 999999) / 1000000)) <= 0) return;
+        char b[1 << 16]; ssize_t n = ::read(inFd, b, sizeof b);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        {
+            lock_guard<mutex> lk(ioMu);
+            if (n <= 0) inEof = true; else { inBuf.erase(0, inPos); inPos = 0; inBuf.append(b, (size_t)n); }
+        }
+        for (size_t k = inq.n.load(); k--;) notify(w, inq);
+#else
+        (void)w; (void)d;
+#endif
+    }
+
+    EMINOR_INLINE Capsule* capAt(Capsule* cb, uint32_t nc, uint32_t id, const uint8_t* at) {
+        if (id >= nc) trap(at, "capsule id " + to_string(id) + " out of range");
+        return cb + id;
+    }
+
+    // --profile
+    const string& funcAt(uint32_t pc) const {
+        static const string unknown = "?";
+        auto it = upper_bound(funcs.begin(), funcs.end(), pc, [](uint32_t a, const pair<uint32_t, string>& f) { return a < f.first; });
+        return it == funcs.begin() ? unknown : (it - 1)->second;
+    }
+    // t's call stack down to pc, outermost first ("@main;$f;$g"). A return address minus one lies in the caller.
+    string& profStack(Prof& p, const Task& t, uint32_t pc) {
+        p.key.clear();
+        for (uint32_t r : t.calls) { p.key += funcAt(r - 1); p.key += ';'; }
+        p.key += funcAt(pc); return p.key;
+    }
+    void profOp(Worker& w, const Task& t, const uint8_t* at) {
+        Prof& p = *w.prof; uint8_t op = *at;
+        p.ops[op]++; if (p.last >= 0) p.pairs[p.last][op]++; p.last = op;
+        if (++p.tick == kProfEvery) { p.tick = 0; p.cpu[profStack(p, t, (uint32_t)(at - code))]++; }
+    }
+    // t resumes after parking on the #send/#recv at t.pc: the wait goes under its stack plus a "#recv $chan" frame.
+    void profWait(Worker& w, Task& t) {
+        OpDec d; long long ns = now_ns() - t.parkAt; t.parkAt = 0;
+        if (!decodeAt(t.pc, d)) return;
+        string& k = profStack(*w.prof, t, t.pc);
+        k += d.op == OP_SEND ? ";#send " : ";#recv "; k += d.f[0] < capNames.size() ? capNames[d.f[0]] : "?";
+        w.prof->wait[k] += (uint64_t)ns;
+    }
+    // PREFIX.cpu.folded: sampled stacks. PREFIX.ops.folded: "A;B n" per opcode pair, "A n" for A ending a slice, so
+    // the first level of the graph is the opcode mix and the second what follows each. PREFIX.wait.folded: microseconds.
+    void writeProfile() {
+        auto all = make_unique<Prof>(); map<string, uint64_t> cpu, wait;
+        for (auto& w : workers) {
+            Prof& p = *w->prof;
+            for (size_t a = 0; a < 256; a++) { all->ops[a] += p.ops[a]; for (size_t b = 0; b < 256; b++) all->pairs[a][b] += p.pairs[a][b]; }
+            for (auto& kv : p.cpu) cpu[kv.first] += kv.second;
+            for (auto& kv : p.wait) wait[kv.first] += kv.second;
+        }
+        auto file = [&](const char* ext, auto body) {
+            string path = profile + ext; auto dir = filesystem::path(path).parent_path(); if (!dir.empty()) filesystem::create_directories(dir);
+            ofstream f(path, ios::binary); if (!f) throw runtime_error("cannot write: " + path);
+            OutBuf o(f); body(o);
+        };
+        auto line = [](OutBuf& o, string_view k, uint64_t n) { o.put(k); o.put(' '); o.dec(n); o.put('\n'); };
+        file(".cpu.folded", [&](OutBuf& o) { for (auto& kv : cpu) line(o, kv.first, kv.second); });
+        file(".ops.folded", [&](OutBuf& o) {
+            for (size_t a = 0; a < 256; a++) {
+                if (!all->ops[a]) continue;
+                uint64_t paired = 0; string k = op_name((uint8_t)a); k += ';';
+                for (size_t b = 0; b < 256; b++) if (uint64_t n = all->pairs[a][b]) { paired += n; line(o, k + op_name((uint8_t)b), n); }
+                if (all->ops[a] > paired) line(o, op_name((uint8_t)a), all->ops[a] - paired);
+            }
+        });
+        file(".wait.folded", [&](OutBuf& o) { for (auto& kv : wait) if (kv.second >= 1000) line(o, kv.first, kv.second / 1000); });
+    }
+
+    // now + d in steady-clock ns for a 64-bit EXPIRE/SLEEP duration, saturated
+    static long long deadline(unsigned long long d) { long long n = now_ns(); return d >= (unsigned long long)(LLONG_MAX - n) ? LLONG_MAX : n + (long long)d; }
+    CapMeta& metaOf(Worker& w, Task& t, Capsule& c) { if (!c.meta) { c.meta = w.meta.get(); t.nMeta++; } return *c.meta; }
+    void dropMeta(Worker& w, Task& t, Capsule& c) { if (c.meta) { w.meta.put(c.meta); c.meta = nullptr; t.nMeta--; } }
+
+    Chan& chanAt(uint32_t id, const uint8_t* at) {
+        if (id >= chans.size() || !chans[id].ring) trap(at, "capsule id " + to_string(id) + " is not a channel");
+        return chans[id];
+    }
+    void noteError(long long code) {
+        long long m = maxErr.load(memory_order_relaxed);
+        while (code > m && !maxErr.compare_exchange_weak(m, code, memory_order_relaxed)) {}
+    }
+
+#if EMINOR_JIT
+    static void jitPrint(Vm* vm, long long v, Worker* w) { vm->print(*w, v); }
+
+    // Enters the native loop at h when there is one (counting toward compiling it otherwise) and returns the pc the
+    // interpreter resumes at: h itself when nothing ran. b is the backward jump that got here.
+    uint32_t jitLoop(Worker& w, Task& t, uint32_t h, uint32_t b, uint32_t& fuel) {
+        uint32_t s = hot[h].load(memory_order_acquire);
+        if (s < kJitHot) {
+            if (!hot[h].compare_exchange_weak(s, s + 1, memory_order_relaxed) || s + 1 < kJitHot) return h;
+            s = jitCompile(h, b); hot[h].store(s, memory_order_release);
+        }
+        if (s < kJitBase || s == kJitNone) return h;
+        const JitRegion& r = regions[s - kJitBase];
+        auto& st = t.stack; size_t n0 = st.size(); if (n0 + r.maxDepth > kMaxStack) return h;
+        st.resize(n0 + r.maxDepth);
+        JitCtx c{ st.data() + n0, t.caps.data(), this, fuel, h, 0, 0, &w };
+        r.fn(&c);
+        st.resize(n0 + c.depth); fuel = c.fuel; return c.pc;
+    }
+
+    // Compiles [h, b] to a region and returns its hot[] state. Every instruction is placed at a static stack depth
+    // relative to the one at h: the fallthrough depth, or that of the first forward branch to it. A branch arriving
+    // with another depth, one leaving the loop and one to an instruction not placed yet goes to an exit stub.
+    uint32_t jitCompile(uint32_t h, uint32_t b) {
+        lock_guard<mutex> lk(jitMu);
+        uint8_t bop = code[b];
+        if (nRegions == kJitMaxRegions || !(op_cond_branch(bop) || bop == OP_JMP)) return kJitNone;
+        const uint32_t kNone = ~0u;
+        vector<OpDec> ops; vector<uint32_t> pcs, ix(b - h + 1, kNone);
+        for (uint32_t pc = h; pc <= b;) {
+            OpDec d; if (ops.size() == kJitMaxInsns || !decodeAt(pc, d)) return kJitNone;
+            ix[pc - h] = (uint32_t)ops.size(); pcs.push_back(pc); ops.push_back(d); pc += d.len;
+        }
+        if (pcs.back() != b) return kJitNone;
+
+        X64 x; x.prologue(); x.ldCtx(offsetof(JitCtx, sp), offsetof(JitCtx, caps), offsetof(JitCtx, fuel));
+        struct Exit { size_t hole; uint32_t pc, depth; bool fuel; };
+        const uint8_t kJmp = 0xFF; // as a condition code: unconditional
+        vector<Exit> exits; vector<vector<pair<size_t, uint32_t>>> fwd(ops.size()); // fwd: forward branches waiting for an instruction
+        vector<size_t> label(ops.size(), SIZE_MAX); vector<uint32_t> depthOf(ops.size(), kNone);
+        auto exitTo = [&](uint8_t cc, uint32_t pc, uint32_t dep, bool fuel = false) { exits.push_back({ cc == kJmp ? x.jmp() : x.jcc(cc), pc, dep, fuel }); };
+        auto goTo = [&](uint8_t cc, uint32_t tgt, uint32_t dep, size_t i) {
+            uint32_t j = tgt >= h && tgt <= b ? ix[tgt - h] : kNone;
+            if (j != kNone && j > i) { fwd[j].push_back({ cc == kJmp ? x.jmp() : x.jcc(cc), dep }); return; }
+            if (j == kNone || label[j] == SIZE_MAX || depthOf[j] != dep) { exitTo(cc, tgt, dep); return; }
+            size_t skip = 0; if (cc != kJmp) { x.b({ (uint8_t)(0x70 | (cc ^ 1)), 0 }); skip = x.c.size(); } // jncc rel8 over the back edge
+            x.b({ 0x41, 0xFF, 0xCE }); x.patch(x.jcc(X64::CC_NE), label[j]); exitTo(kJmp, tgt, dep, true); // dec r14d; jnz back; out of fuel
+            if (cc != kJmp) x.c[skip - 1] = (uint8_t)(x.c.size() - skip);
+        };
+        auto S = [](uint32_t d) { return 8 * d; };
+        auto C = [](uint32_t id, size_t field) { return id * (uint32_t)sizeof(Capsule) + (uint32_t)field; };
+        auto capOk = [&](uint32_t id) { return id < nCaps && id < (1u << 24); };
+        vector<char> join(ops.size(), 0); // branch targets: nothing is known to be in a register there
+        for (auto& o : ops) {
+            uint32_t t = o.op == OP_JZ || o.op == OP_JNZ || o.op == OP_JMP ? o.f[0] : op_is_cmpj(o.op) ? o.f[2] : kNone;
+            if (t >= h && t <= b && ix[t - h] != kNone) join[ix[t - h]] = 1;
+        }
+        uint32_t d = 0, maxD = 0, inRax = kNone; bool live = true; // live: the previous instruction falls through
+        auto ldV = [&](uint32_t id) { if (inRax != id) x.ldC(X64::RAX, C(id, offsetof(Capsule, v))); }; // rax = capsule value
+        auto arith = [&](uint8_t bo, uint32_t pc, uint32_t dep) { // rax = rax <bo> rcx
+            switch (bo) {
+            case B_ADD: x.b({ 0x48, 0x01, 0xC8 }); break;       // add rax, rcx
+            case B_SUB: x.b({ 0x48, 0x29, 0xC8 }); break;       // sub rax, rcx
+            case B_MUL: x.b({ 0x48, 0x0F, 0xAF, 0xC1 }); break; // imul rax, rcx
+            case B_DIV: case B_MOD:
+                x.b({ 0x48, 0x8D, 0x51, 0x01, 0x48, 0x83, 0xFA, 0x01 }); // lea rdx, [rcx + 1]; cmp rdx, 1: the interpreter takes 0 and -1
+                exitTo(X64::CC_BE, pc, dep);
+                x.b({ 0x48, 0x99, 0x48, 0xF7, 0xF9 });                   // cqo; idiv rcx
+                if (bo == B_MOD) x.b({ 0x48, 0x89, 0xD0 });              // mov rax, rdx
+                break;
+            case B_OR: case B_AND: // test/setne both, then or/and al, cl
+                x.b({ 0x48, 0x85, 0xC0, 0x0F, 0x95, 0xC0, 0x48, 0x85, 0xC9, 0x0F, 0x95, 0xC1, (uint8_t)(bo == B_OR ? 0x08 : 0x20), 0xC8, 0x0F, 0xB6, 0xC0 });
+                break;
+            default: x.b({ 0x48, 0x39, 0xC8, 0x0F, (uint8_t)(0x90 | X64::ccOf(bo)), 0xC0, 0x0F, 0xB6, 0xC0 }); // cmp rax, rcx; setcc al; movzx
+            }
+        };
+        for (size_t i = 0; i < ops.size(); i++) {
+            const OpDec& o = ops[i]; uint32_t pc = pcs[i];
+            if (!live) { if (fwd[i].empty()) continue; d = fwd[i][0].second; live = true; }
+            if (join[i]) inRax = kNone;
+            uint32_t keep = kNone; // the capsule whose value rax holds afterwards
+            depthOf[i] = d; label[i] = x.c.size();
+            for (auto& [hole, dep] : fwd[i]) { if (dep == d) x.patch(hole, label[i]); else exits.push_back({ hole, pc, dep, false }); }
+            bool ok = true;
+            switch (o.op) {
+            case OP_PUSHK: x.imm(X64::RAX, o.f[0]); x.stS(X64::RAX, S(d)); d++; break;
+            case OP_PUSHCAP: if (!(ok = capOk(o.f[0]))) break; ldV(o.f[0]); x.stS(X64::RAX, S(d)); d++; keep = o.f[0]; break;
+            case OP_PUSHCAP2:
+                if (!(ok = capOk(o.f[0]) && capOk(o.f[1]))) break;
+                ldV(o.f[0]); x.ldC(X64::RCX, C(o.f[1], offsetof(Capsule, v)));
+                x.stS(X64::RAX, S(d)); x.stS(X64::RCX, S(d + 1)); d += 2; keep = o.f[0]; break;
+            case OP_UN: {
+                uint8_t u = code[pc + 1]; if (!(ok = d >= 1 && u >= 1 && u <= 3)) break;
+                x.ldS(X64::RAX, S(d - 1));
+                if (u == 1) x.b({ 0x48, 0x85, 0xC0, 0x0F, 0x94, 0xC0, 0x0F, 0xB6, 0xC0 }); // test rax, rax; sete al; movzx eax, al
+                else x.b({ 0x48, 0xF7, (uint8_t)(u == 2 ? 0xD8 : 0xD0) });              // neg rax / not rax
+                x.stS(X64::RAX, S(d - 1)); break;
+            }
+            case OP_BIN: {
+                uint8_t bo = code[pc + 1]; if (!(ok = d >= 2 && bo >= B_OR && bo <= B_MOD)) break;
+                x.ldS(X64::RAX, S(d - 2)); x.ldS(X64::RCX, S(d - 1)); arith(bo, pc, d);
+                x.stS(X64::RAX, S(d - 2)); d--; break;
+            }
+            case OP_MOVCAP:
+                if (!(ok = capOk(o.f[0]) && capOk(o.f[1]))) break;
+                ldV(o.f[1]); x.stC(X64::RAX, C(o.f[0], offsetof(Capsule, v))); x.markInit(C(o.f[0], offsetof(Capsule, hdr))); keep = o.f[0]; break;
+            case OP_BINCAP: case OP_BINK: {
+                uint8_t bo = code[pc + o.len - 1];
+                if (!(ok = capOk(o.f[0]) && capOk(o.f[1]) && (o.op == OP_BINK || capOk(o.f[2])) && bo >= B_OR && bo <= B_MOD)) break;
+                ldV(o.f[1]); if (o.op == OP_BINK) x.imm(X64::RCX, o.f[2]); else x.ldC(X64::RCX, C(o.f[2], offsetof(Capsule, v)));
+                arith(bo, pc, d);
+                x.stC(X64::RAX, C(o.f[0], offsetof(Capsule, v))); x.markInit(C(o.f[0], offsetof(Capsule, hdr))); keep = o.f[0]; break;
+            }
+            case OP_LOAD:
+                if (!(ok = d >= 1 && capOk(o.f[0]))) break;
+                x.ldS(X64::RAX, S(d - 1)); x.stC(X64::RAX, C(o.f[0], offsetof(Capsule, v))); x.markInit(C(o.f[0], offsetof(Capsule, hdr))); d--; keep = o.f[0]; break;
+            case OP_LOAD_K: case OP_INCCAP: // the new value stays in rax: a CMPJ on it usually comes next
+                if (!(ok = capOk(o.f[0]))) break;
+                if (o.op == OP_INCCAP) x.ldC(X64::RCX, C(o.f[0], offsetof(Capsule, v)));
+                x.imm(X64::RAX, o.f[1]); if (o.op == OP_INCCAP) x.b({ 0x48, 0x01, 0xC8 }); // add rax, rcx
+                x.stC(X64::RAX, C(o.f[0], offsetof(Capsule, v))); x.markInit(C(o.f[0], offsetof(Capsule, hdr))); keep = o.f[0]; break;
+            case OP_INIT:
+                if (!(ok = capOk(o.f[0]))) break;
+                x.b({ 0x49, 0x83, 0xBD }); x.d32(C(o.f[0], offsetof(Capsule, meta))); x.b({ 0x00 }); // cmp qword [r13 + meta], 0
+                exitTo(X64::CC_NE, pc, d);                                                           // metadata goes back to the pool
+                x.b({ 0x49, 0xC7, 0x85 }); x.d32(C(o.f[0], offsetof(Capsule, v))); x.d32(0);         // mov qword [r13 + v], 0
+                x.b({ 0x41, 0xC7, 0x85 }); x.d32(C(o.f[0], offsetof(Capsule, hdr))); x.d32(CS_INIT); // mov dword [r13 + hdr], CS_INIT
+                break;
+            case OP_OUTPUT: case OP_RENDER:
+                if (o.op == OP_OUTPUT && o.f[0] == 0) { if (!(ok = d >= 1)) break; x.ldS(X64::RSI, S(d - 1)); d--; }
+                else { if (!(ok = capOk(o.f[0]))) break; x.ldC(X64::RSI, C(o.f[0], offsetof(Capsule, v))); }
+                x.b({ 0x48, 0x8B, 0x7B, (uint8_t)offsetof(JitCtx, vm) }); // mov rdi, [rbx + vm]
+                x.b({ 0x48, 0x8B, 0x53, (uint8_t)offsetof(JitCtx, w) }); x.call((const void*)&Vm::jitPrint); // mov rdx, [rbx + w]
+                break;
+            case OP_JZ: case OP_JNZ:
+                if (!(ok = d >= 1 && o.f[0] < textSize)) break;
+                x.ldS(X64::RAX, S(d - 1)); x.b({ 0x48, 0x85, 0xC0 }); d--; // test rax, rax
+                goTo(o.op == OP_JZ ? X64::CC_E : X64::CC_NE, o.f[0], d, i); break;
+            case OP_JMP: if (!(ok = o.f[0] < textSize)) break; goTo(kJmp, o.f[0], d, i); live = false; break;
+            case OP_CMPJEQ: case OP_CMPJNE: case OP_CMPJLT: case OP_CMPJGT: case OP_CMPJLE: case OP_CMPJGE:
+                if (!(ok = capOk(o.f[0]) && o.f[2] < textSize)) break;
+                ldV(o.f[0]); x.imm(X64::RCX, o.f[1]); x.b({ 0x48, 0x39, 0xC8 }); // cmp rax, rcx
+                goTo((uint8_t)(X64::ccOf(cmp_of_cmpj(o.op)) ^ 1), o.f[2], d, i); keep = o.f[0]; break; // jumps when the comparison fails
+            default: ok = false;
+            }
+            if (!ok) { exitTo(kJmp, pc, d); live = false; } // the interpreter runs (or traps on) this one
+            maxD = max(maxD, d); inRax = keep;
+        }
+        if (live) exitTo(kJmp, pcs.back() + ops.back().len, d);
+        unordered_map<uint64_t, size_t> stubs; // (pc, depth, fuel) -> stub
+        for (auto& e : exits) {
+            auto [it, fresh] = stubs.emplace((uint64_t)e.pc << 32 | (uint64_t)e.depth << 1 | e.fuel, x.c.size());
+            if (fresh) {
+                if (e.fuel) x.b({ 0x41, 0xBE, 0x01, 0x00, 0x00, 0x00 }); // mov r14d, 1: the interpreter's own check runs next
+                x.exitStub(offsetof(JitCtx, pc), e.pc, offsetof(JitCtx, depth), e.depth, offsetof(JitCtx, fuel));
+            }
+            x.patch(e.hole, it->second);
+        }
+        JitRegion& r = regions[nRegions];
+        if (!(r.mem = jit_map(x.c, r.size))) return kJitNone;
+        r.fn = (JitFn)r.mem; r.maxDepth = maxD;
+        return kJitBase + (uint32_t)nRegions++;
+    }
+#endif
+
+    template <bool Compact> Stop exec(Task* tp, Worker* wp) {
+#if EMINOR_VM_THREADED
+        void* const* jt = this->jt[Compact + (wp && wp->prof ? 2 : 0)];
+        if (!tp) {
+            for (auto& e : this->jt[Compact + 2]) e = &&L_PROF;
+            auto& jt = this->jt[Compact];
+            for (auto& e : jt) e = &&L_BAD;
+            jt[OP_INIT] = &&L_OP_INIT; jt[OP_LEASE] = &&L_OP_LEASE; jt[OP_SUBLEASE] = &&L_OP_SUBLEASE; jt[OP_RELEASE] = &&L_OP_RELEASE;
+            jt[OP_LOAD] = &&L_OP_LOAD; jt[OP_CALL] = &&L_OP_CALL; jt[OP_EXIT] = &&L_OP_EXIT;
+            jt[OP_RENDER] = &&L_OP_RENDER; jt[OP_INPUT] = &&L_OP_INPUT; jt[OP_OUTPUT] = &&L_OP_OUTPUT;
+            jt[OP_SEND] = &&L_OP_SEND; jt[OP_RECV] = &&L_OP_RECV; jt[OP_SPAWN] = &&L_OP_SPAWN; jt[OP_JOIN] = &&L_OP_JOIN;
+            jt[OP_STAMP] = &&L_OP_STAMP; jt[OP_EXPIRE] = &&L_OP_EXPIRE; jt[OP_SLEEP] = &&L_OP_SLEEP; jt[OP_YIELD] = &&L_OP_YIELD; jt[OP_ERROR] = &&L_OP_ERROR;
+            jt[OP_PUSHK] = &&L_OP_PUSHK; jt[OP_PUSHCAP] = &&L_OP_PUSHCAP; jt[OP_UN] = &&L_OP_UN; jt[OP_BIN] = &&L_OP_BIN;
+            jt[OP_JZ] = &&L_OP_JZ; jt[OP_JNZ] = &&L_OP_JNZ; jt[OP_JMP] = &&L_OP_JMP;
+            jt[OP_PUSHCAP2] = &&L_OP_PUSHCAP2; jt[OP_LOAD_K] = &&L_OP_LOAD_K; jt[OP_INCCAP] = &&L_OP_INCCAP;
+            jt[OP_MOVCAP] = &&L_OP_MOVCAP; jt[OP_BINCAP] = &&L_OP_BINCAP; jt[OP_BINK] = &&L_OP_BINK;
+            jt[OP_CMPJEQ] = &&L_OP_CMPJEQ; jt[OP_CMPJNE] = &&L_OP_CMPJNE; jt[OP_CMPJLT] = &&L_OP_CMPJLT;
+            jt[OP_CMPJGT] = &&L_OP_CMPJGT; jt[OP_CMPJLE] = &&L_OP_CMPJLE; jt[OP_CMPJGE] = &&L_OP_CMPJGE;
+            jt[OP_END] = &&L_OP_END;
+            return Stop::Done;
+        }
+#define VM_CASE(op) L_##op:
+#define VM_NEXT() do { at = ip; goto *jt[*ip++]; } while (0)
+#define VM_DEFAULT L_BAD:
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT() continue
+#define VM_DEFAULT default:
+#endif
+#define VM_U32() (ip += 4, rd_u32le(ip - 4))
+#define VM_POP(dst) do { if (st.empty()) trap(at, "operand stack underflow"); dst = st.back(); st.pop_back(); } while (0)
+#define VM_PUSH(v) do { if (st.size() >= kMaxStack) trap(at, "operand stack overflow"); st.push_back(v); } while (0)
+#define VM_JUMP(a) do {                                                                           \
+            uint32_t a_ = (a); if (a_ >= textSize) trap(at, "jump out of range");                 \
+            if (base + a_ <= at) {                                                                \
+                VM_JIT(a_);                                                                       \
+                if (!--fuel) {                                                                    \
+                    fuel = kSlice; if (stopping.load(memory_order_relaxed)) return Stop::Halt;    \
+                    if (othersWaiting(w)) { ip = base + a_; VM_SAVE(ip); return Stop::Yield; }    \
+                }                                                                                 \
+            }                                                                                     \
+            ip = base + a_;                                                                       \
+        } while (0)
+#define VM_SAVE(to) (t.pc = (uint32_t)((to) - base))
+#if EMINOR_JIT
+#define VM_JIT(a) do { if (hot && *at != OP_CALL) a = jitLoop(w, t, a, (uint32_t)(at - base), fuel); } while (0) // a: the resume pc
+#else
+#define VM_JIT(a) do {} while (0)
+#endif
+// Operands by kind: 32 bits each in the wide form, LEB128 fields in the compact one (see compact_encode)
+#define VM_LEB(rd) (lb = rd(ip), ip += lb.n, lb.v)
+#define VM_ID() (Compact ? VM_LEB(rd_uleb) : VM_U32())
+#define VM_K() (Compact ? poolK(VM_LEB(rd_uleb), at) : VM_U32())
+#define VM_TGT() (Compact ? (uint32_t)(at - base) + VM_LEB(rd_sleb) : VM_U32())
+#define VM_CAP() (*capAt(cb, nc, VM_ID(), at))
+
+        Task& t = *tp; Worker& w = *wp; auto& st = t.stack; uint32_t fuel = kSlice;
+        Capsule* const cb = t.caps.data(); const uint32_t nc = (uint32_t)t.caps.size(); // fixed for the task's lifetime
+        const uint8_t* const base = code;
+        const uint8_t* ip = base + t.pc;
+        const uint8_t* at = ip; // start of the current instruction (for traps / retries)
+        Leb lb; (void)lb;       // compact operand being read
+#if EMINOR_VM_THREADED
+        VM_NEXT();
+        L_PROF: profOp(w, t, at); goto *this->jt[Compact][*at];
+#else
+        Prof* const pf = w.prof.get();
+        for (;;) { at = ip; if (pf) profOp(w, t, at); switch (*ip++) {
+#endif
+        VM_CASE(OP_INIT) { Capsule& c = VM_CAP(); dropMeta(w, t, c); c.v = 0; c.hdr = CS_INIT; VM_NEXT(); }
+        VM_CASE(OP_LEASE) {
+            Capsule& c = VM_CAP();
+            if (c.hdr > CS_INIT) trap(at, c.hdr == CS_RELEASED ? "lease after release" : "lease of a capsule that is already leased/subleased");
+            c.hdr = CS_LEASED; VM_NEXT();
+        }
+        VM_CASE(OP_SUBLEASE) {
+            Capsule& c = VM_CAP(); uint32_t s = c.hdr & CS_MASK;
+            if (s >= CS_LEASED) trap(at, s == CS_LEASED ? "sublease of an exclusively leased capsule" : "sublease after release");
+            c.hdr += CS_SUBLEASE; VM_NEXT();
+        }
+        VM_CASE(OP_RELEASE) {
+            Capsule& c = VM_CAP();
+            if (c.hdr == CS_LEASED) c.hdr = CS_INIT; // exclusive leases never have subleases
+            else if (c.hdr >= CS_SUBLEASE) c.hdr -= CS_SUBLEASE;
+            else c.hdr = CS_RELEASED;
+            VM_NEXT();
+        }
+        VM_CASE(OP_LOAD) { long long v; VM_POP(v); Capsule& c = VM_CAP(); c.v = v; if (c.hdr != CS_LEASED) c.hdr = (c.hdr & ~CS_MASK) | CS_INIT; VM_NEXT(); }
+        VM_CASE(OP_CALL) {
+            uint32_t a = VM_TGT();
+            if (!hosts.empty()) if (auto it = hosts.find(a); it != hosts.end()) { callHost(t, it->second, at); VM_NEXT(); }
+            if (t.calls.size() >= kMaxCalls) trap(at, "call depth exceeded");
+            t.calls.push_back((uint32_t)(ip - base)); enterFrame(w, t, a); VM_JUMP(a); VM_NEXT();
+        }
+        VM_CASE(OP_EXIT) {
+            if (!t.calls.empty()) { leaveFrame(w, t); ip = base + t.calls.back(); t.calls.pop_back(); VM_NEXT(); }
+            VM_SAVE(ip); return Stop::Done;
+        }
+        VM_CASE(OP_RENDER) { long long v = VM_CAP().v; print(w, v); VM_NEXT(); }
+        VM_CASE(OP_INPUT) { long long v; if (!readInput(v)) { VM_SAVE(at); return Stop::Block; } Capsule& c = VM_CAP(); c.v = v; c.hdr = (c.hdr & ~CS_MASK) | CS_INIT; VM_NEXT(); }
+        VM_CASE(OP_OUTPUT) {
+            uint32_t id = VM_ID();
+            long long v; if (id == 0) VM_POP(v); else v = capAt(cb, nc, id, at)->v; // print: value on the stack
+            print(w, v); VM_NEXT();
+        }
+        VM_CASE(OP_SEND) {
+            uint32_t ch = VM_ID(), pk = VM_ID(); handOff(w); // the receiver may print next
+            Chan& q = chanAt(ch, at); Capsule& c = *capAt(cb, nc, pk, at);
+            if (!q.tryPush(c)) { VM_SAVE(at); return Stop::Block; } // full
+            if (c.meta) t.nMeta--; // ownership (metadata block included) moved into the channel
+            c.v = 0; c.hdr = CS_RELEASED; c.meta = nullptr;
+            notify(w, q.recvq); VM_NEXT();
+        }
+        VM_CASE(OP_RECV) {
+            uint32_t ch = VM_ID(), pk = VM_ID();
+            Chan& q = chanAt(ch, at); Capsule& c = *capAt(cb, nc, pk, at);
+            Capsule in; if (!q.tryPop(in)) { VM_SAVE(at); return Stop::Block; } // empty
+            dropMeta(w, t, c); c = in; if (c.meta) t.nMeta++;
+            notify(w, q.sendq); VM_NEXT();
+        }
+        VM_CASE(OP_SPAWN) {
+            uint32_t a = VM_TGT(); uint8_t argc = *ip++;
+            if (a >= textSize) trap(at, "spawn target out of range");
+            if (st.size() < argc) trap(at, "operand stack underflow");
+            Task* c = spawn(w, a, &t);
+            c->stack.assign(st.end() - argc, st.end()); st.resize(st.size() - argc);
+            handOff(w); w.dq.push(c); kick();
+            VM_NEXT();
+        }
+        VM_CASE(OP_JOIN) {
+            uint32_t id = VM_ID();
+            if (!helpJoin(w, t, id)) { VM_SAVE(at); return stopping.load() ? Stop::Halt : Stop::Block; }
+            VM_NEXT();
+        }
+        VM_CASE(OP_STAMP) { Capsule& c = VM_CAP(); metaOf(w, t, c).stamp = VM_K(); VM_NEXT(); }
+        VM_CASE(OP_EXPIRE) { Capsule& c = VM_CAP(); unsigned long long d = VM_K(); d |= (unsigned long long)VM_K() << 32; metaOf(w, t, c).expiry = deadline(d); VM_NEXT(); }
+        VM_CASE(OP_SLEEP) { unsigned long long d = VM_K(); d |= (unsigned long long)VM_K() << 32; t.wake = deadline(d); VM_SAVE(ip); return Stop::Yield; }
+        VM_CASE(OP_YIELD) { VM_SAVE(ip); return Stop::Yield; }
+        VM_CASE(OP_ERROR) {
+            Capsule& c = VM_CAP(); long long codev = (long long)VM_K(); metaOf(w, t, c).errMsg = VM_K();
+            c.v = codev; if ((c.hdr & CS_MASK) == CS_UNINIT) c.hdr |= CS_INIT;
+            noteError(codev);
+            VM_NEXT();
+        }
+        VM_CASE(OP_PUSHK) { long long v = (long long)VM_K(); VM_PUSH(v); VM_NEXT(); }
+        VM_CASE(OP_PUSHCAP) { long long v = VM_CAP().v; VM_PUSH(v); VM_NEXT(); }
+        VM_CASE(OP_UN) {
+            uint8_t u = *ip++;
+            if (st.empty()) trap(at, "operand stack underflow");
+            if (!eval_un(u, st.back(), st.back())) trap(at, "bad unary operator");
+            VM_NEXT();
+        }
+        VM_CASE(OP_BIN) {
+            uint8_t b = *ip++;
+            if (st.size() < 2) trap(at, "operand stack underflow");
+            long long rhs = st.back(); st.pop_back();
+            if (!eval_bin(b, st.back(), rhs, st.back())) trap(at, b == B_DIV || b == B_MOD ? "division by zero" : "bad binary operator");
+            VM_NEXT();
+        }
+        VM_CASE(OP_JZ) { uint32_t a = VM_TGT(); long long v; VM_POP(v); if (!v) VM_JUMP(a); VM_NEXT(); }
+        VM_CASE(OP_JNZ) { uint32_t a = VM_TGT(); long long v; VM_POP(v); if (v) VM_JUMP(a); VM_NEXT(); }
+        VM_CASE(OP_JMP) { VM_JUMP(VM_TGT()); VM_NEXT(); }
+        VM_CASE(OP_PUSHCAP2) { long long a = VM_CAP().v, b = VM_CAP().v; VM_PUSH(a); VM_PUSH(b); VM_NEXT(); }
+        VM_CASE(OP_LOAD_K) { Capsule& c = VM_CAP(); c.v = (long long)VM_K(); if (c.hdr != CS_LEASED) c.hdr = (c.hdr & ~CS_MASK) | CS_INIT; VM_NEXT(); }
+        VM_CASE(OP_INCCAP) {
+            Capsule& c = VM_CAP(); c.v = (long long)((unsigned long long)c.v + VM_K());
+            if (c.hdr != CS_LEASED) c.hdr = (c.hdr & ~CS_MASK) | CS_INIT;
+            VM_NEXT();
+        }
+        VM_CASE(OP_MOVCAP) { Capsule& c = VM_CAP(); c.v = VM_CAP().v; if (c.hdr != CS_LEASED) c.hdr = (c.hdr & ~CS_MASK) | CS_INIT; VM_NEXT(); }
+#define VM_BIN3(op, rhs) VM_CASE(op) {                                                                                      \
+            Capsule& c = VM_CAP(); long long a = VM_CAP().v, b = (long long)rhs; uint8_t o = *ip++;                       \
+            if (!eval_bin(o, a, b, c.v)) trap(at, o == B_DIV || o == B_MOD ? "division by zero" : "bad binary operator"); \
+            if (c.hdr != CS_LEASED) { c.hdr = (c.hdr & ~CS_MASK) | CS_INIT; }                                             \
+            VM_NEXT();                                                                                                    \
+        }
+        VM_BIN3(OP_BINCAP, VM_CAP().v) VM_BIN3(OP_BINK, VM_K())
+#undef VM_BIN3
+#define VM_CMPJ(op, expr) VM_CASE(op) { long long a = VM_CAP().v, k = (long long)VM_K(); uint32_t t_ = VM_TGT(); if (!(expr)) VM_JUMP(t_); VM_NEXT(); }
+        VM_CMPJ(OP_CMPJEQ, a == k) VM_CMPJ(OP_CMPJNE, a != k) VM_CMPJ(OP_CMPJLT, a < k)
+        VM_CMPJ(OP_CMPJGT, a > k) VM_CMPJ(OP_CMPJLE, a <= k) VM_CMPJ(OP_CMPJGE, a >= k)
+#undef VM_CMPJ
+        VM_CASE(OP_END) { VM_SAVE(ip - 1); return Stop::Halt; }
+        VM_DEFAULT { trap(at, "undefined opcode 0x" + hex2(*at)); }
+#if !EMINOR_VM_THREADED
+        } }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_DEFAULT
+#undef VM_U32
+#undef VM_POP
+#undef VM_PUSH
+#undef VM_JUMP
+#undef VM_SAVE
+#undef VM_JIT
+#undef VM_LEB
+#undef VM_ID
+#undef VM_K
+#undef VM_TGT
+#undef VM_CAP
+    }
+};
+
+//
+// Modules and the module linker
+//   Every source file is a module with its own Lexer/Parser/Arena/Emitter. @import "path" makes the @export'ed
+//   functions/workers of path callable by name; @import "path:$f" [as $g] binds one of them (net:<path>:$f also
+//   works). Un-exported definitions stay private: the root module keeps plain symbol names, the others appear as
+//   "<module>::$f" (plus each binding under its local name, for #spawn/#join). Capsule and channel names are
+//   shared across modules, as if the files were one. Paths resolve against the importer's module root (its path
+//   minus its @module name), its directory, then each -I directory; ".eminor" is implied.
+//   load parses one import level at a time in parallel; check/emit/optimize run the modules in parallel.
+//
+struct Program {
+    struct Import { size_t mod; string spec, sym, alias; uint32_t pos; }; // sym empty: every export of mod
+    struct Module {
+        string path, name; bool named = false; string src; Arena own, * arena = &own; unique_ptr<Parser> ps; Node* ast = nullptr; // named: has an @module header
+        vector<Import> imports; unordered_set<string> exports;
+        unordered_map<string, pair<size_t, string>> binds; // local name -> (module, exported name)
+        vector<Diagnostic> diags;
+        Emitter em; Emitter::BuildResult br;
+        // What link() and the stats read: taken from em, or from the cache entry when the module is cached (no AST, no em)
+        vector<string> strs; vector<uint32_t> strOff; size_t nTokens = 0, nNodes = 0, nRelocs = 0, naiveBytes = 0, preOpt = 0;
+        bool cached = false; string key; vector<string> externs; // externs: sorted bound names the object was built against
+    };
+    deque<Module> mods; unordered_map<string, size_t> byPath; // deque: modules are referenced while others are added
+    vector<string> includeDirs; unsigned jobs = 0;
+    const BuildCache* cache = nullptr; bool opt = true, regs = false; uint32_t starRules = ~0u; // opt, regs and starRules are part of the module key
+    deque<Arena>* arenas = nullptr; // when set, module i parses into (*arenas)[i], rewound (--serve keeps them across builds)
+    unordered_set<string> hosts; // --host / Options::hosts: names a call may leave undefined, linked to a stub (stubHosts)
+    struct Reported { string kind, msg, at; };
+    vector<Reported> reported; ostream* diagOut = &cerr; // StarCode findings of all modules, also printed unless diagOut is null
+
+    static string key(const string& path) { error_code ec; auto p = filesystem::weakly_canonical(path, ec); return (ec ? filesystem::path(path) : p).generic_string(); }
+    // Inner job count: the module level already spreads work when there is more than one module.
+    unsigned innerJobs() const { return mods.size() > 1 ? 1u : jobs; }
+    string where(const Module& m, uint32_t pos) const { return (&m == &mods[0] ? "" : m.path + ":") + LineIndex(m.src).str(pos); }
+
+    size_t add(const string& path) {
+        string k = key(path); auto it = byPath.find(k); if (it != byPath.end()) return it->second;
+        mods.emplace_back(); Module& m = mods.back(); m.path = path; byPath[k] = mods.size() - 1;
+        if (arenas) { if (arenas->size() < mods.size()) arenas->emplace_back(); m.arena = &(*arenas)[mods.size() - 1]; m.arena->reset(); }
+        return mods.size() - 1;
+    }
+
+    void parseAst(Module& m) {
+        try { m.ps = make_unique<Parser>(m.src, *m.arena); m.ast = m.ps->parse(); }
+        catch (const exception& e) { if (&m == &mods[0]) throw; throw runtime_error(m.path + ": " + e.what()); }
+        m.nTokens = m.ps->nTokens; m.nNodes = m.ps->nNodes;
+    }
+
+    // Reads m unless it is the root (whose source the caller supplies) and records its header: from the cache
+    // entry for its source when there is one, else by parsing it.
+    void parse(Module& m) {
+        if (m.src.empty() && &m != &mods[0]) m.src = read_file(m.path);
+        if (cache) {
+            m.key = BuildCache::key({ "module", opt ? "opt" : "no-opt", regs ? "regs" : "stack", to_string(starRules), m.src }); string blob;
+            if (cache->load(m.key, ".emm", blob)) {
+                try { BlobR r{ blob }; loadObject(m, r); m.cached = true; }
+                catch (const exception&) { m.name.clear(); m.named = false; m.exports.clear(); m.imports.clear(); m.diags.clear(); }
+            }
+        }
+        if (!m.cached) {
+            parseAst(m);
+            for (auto& n : m.ast->xs) {
+                if (n->k == Node::K::Module) { m.name = string(n->s1); m.named = true; }
+                else if (n->k == Node::K::Export) m.exports.insert(string(n->s1));
+                else if (n->k == Node::K::Import) {
+                    string spec(n->s1), sym; if (spec.rfind("net:", 0) == 0) spec = spec.substr(4);
+                    size_t c = spec.rfind(":$"); if (c != string::npos) { sym = spec.substr(c + 1); spec.resize(c); }
+                    m.imports.push_back({ 0, spec, sym, string(n->s2), n->pos });
+                }
+            }
+        }
+        if (m.name.empty()) m.name = filesystem::path(m.path).replace_extension().generic_string();
+    }
+
+    // .emm entry: header (name, exports, imports, diagnostics, bound names), stats, string table, linked image.
+    static void saveObject(const Module& m, BlobW& w) {
+        w.u32(m.named); w.str(m.named ? m.name : "");
+        w.u32((uint32_t)m.exports.size()); for (auto& e : m.exports) w.str(e);
+        w.u32((uint32_t)m.imports.size()); for (auto& im : m.imports) { w.str(im.spec); w.str(im.sym); w.str(im.alias); w.u32(im.pos); }
+        w.u32((uint32_t)m.diags.size()); for (auto& d : m.diags) { w.str(d.kind); w.str(d.msg); w.u32(d.pos); }
+        w.u32((uint32_t)m.externs.size()); for (auto& e : m.externs) w.str(e);
+        for (size_t v : { m.nTokens, m.nNodes, m.nRelocs, m.naiveBytes, m.preOpt }) w.u32((uint32_t)v);
+        w.u32((uint32_t)m.strs.size()); for (auto& x : m.strs) w.str(x);
+        w.vec32(m.strOff);
+        const Emitter::BuildResult& br = m.br;
+        w.bytes(br.text); w.bytes(br.rodata);
+        w.u32((uint32_t)br.syms.size()); for (auto& kv : br.syms) { w.str(kv.first); w.u32(kv.second); }
+        w.u32((uint32_t)br.capNames.size()); for (size_t i = 1; i < br.capNames.size(); i++) w.str(br.capNames[i]);
+        w.vec32(br.roRefs);
+        w.u32((uint32_t)br.unresolved.size()); for (auto& r : br.unresolved) { w.u32(r.pos); w.str(r.sym); }
+    }
+    static void loadObject(Module& m, BlobR& r) {
+        m.named = r.u32() != 0; m.name = r.str();
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) m.exports.insert(r.str());
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) { Import im{ 0, r.str(), r.str(), r.str(), 0 }; im.pos = r.u32(); m.imports.push_back(move(im)); }
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) { Diagnostic d; d.kind = r.str(); d.msg = r.str(); d.pos = r.u32(); m.diags.push_back(move(d)); }
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) m.externs.push_back(r.str());
+        for (size_t* v : { &m.nTokens, &m.nNodes, &m.nRelocs, &m.naiveBytes, &m.preOpt }) *v = r.u32();
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) m.strs.push_back(r.str());
+        m.strOff = r.vec32();
+        Emitter::BuildResult br;
+        br.text = r.bytes(); br.rodata = r.bytes();
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) { string k = r.str(); br.syms[k] = r.u32(); }
+        br.capNames.push_back(""); for (uint32_t i = 1, n = r.u32(); i < n; i++) br.capNames.push_back(r.str());
+        br.roRefs = r.vec32();
+        for (uint32_t i = 0, n = r.u32(); i < n; i++) { uint32_t pos = r.u32(); br.unresolved.push_back({ pos, r.str() }); }
+        bool ok = r.i == r.s.size() && m.strOff.size() == m.strs.size();
+        for (uint32_t x : br.roRefs) ok &= (size_t)x + 4 <= br.text.size();
+        for (auto& u : br.unresolved) ok &= (size_t)u.pos + 4 <= br.text.size();
+        if (!ok) throw runtime_error("cache: bad module");
+        check_cached_text(br.text, br.capNames.size());
+        m.br = move(br);
+    }
+
+    string resolve(const Module& from, const string& spec, uint32_t pos) const {
+        auto file = [](string p) { if (filesystem::path(p).extension() != ".eminor") p += ".eminor"; return p; };
+        vector<filesystem::path> roots;
+        string self = filesystem::path(from.path).replace_extension().generic_string();
+        if (from.named && self.size() >= from.name.size() && self.compare(self.size() - from.name.size(), string::npos, from.name) == 0)
+            roots.push_back(self.substr(0, self.size() - from.name.size()));
+        roots.push_back(filesystem::path(from.path).parent_path());
+        for (auto& d : includeDirs) roots.push_back(d);
+        for (auto& r : roots) { auto c = (r / file(spec)).lexically_normal(); if (filesystem::exists(c)) return c.string(); }
+        throw runtime_error("import not found: \"" + spec + "\" @" + where(from, pos));
+    }
+
+    void load(const string& rootPath, string rootSrc) {
+        add(rootPath); mods[0].src = move(rootSrc);
+        for (size_t lo = 0, hi = 1; lo < hi; lo = hi, hi = mods.size()) {
+            parallel_for(hi - lo, jobs, [&](size_t i) { parse(mods[lo + i]); });
+            for (size_t i = lo; i < hi; i++)
+                for (auto& im : mods[i].imports) im.mod = add(resolve(mods[i], im.spec, im.pos));
+        }
+    }
+
+    void check() {
+        parallel_for(mods.size(), jobs, [&](size_t i) { if (mods[i].cached) return; StarCode sc(starRules); sc.run(mods[i].ast); mods[i].diags = move(sc.diags); });
+        bool failed = false;
+        for (auto& m : mods)
+            for (auto& d : m.diags) {
+                reported.push_back({ d.kind, d.msg, where(m, d.pos) }); failed |= d.kind == "error";
+                if (diagOut) *diagOut << d.kind << ": " << d.msg << " @" << reported.back().at << "\n";
+            }
+        if (failed) throw runtime_error("star-code error");
+        for (auto& m : mods) {
+            for (auto& im : m.imports) {
+                Module& t = mods[im.mod];
+                if (im.sym.empty()) { for (auto& e : t.exports) m.binds.emplace(e, make_pair(im.mod, e)); continue; }
+                if (!t.exports.count(im.sym)) throw runtime_error("module " + t.name + " does not export " + im.sym + " @" + where(m, im.pos));
+                m.binds[im.alias.empty() ? im.sym : im.alias] = { im.mod, im.sym };
+            }
+            vector<string> ext; for (auto& b : m.binds) ext.push_back(b.first);
+            for (auto& h : hosts) if (!m.binds.count(h)) ext.push_back(h);
+            sort(ext.begin(), ext.end());
+            if (m.cached && ext != m.externs) { m.cached = false; m.br = {}; m.strs.clear(); m.strOff.clear(); parseAst(m); } // an import's exports changed
+            m.externs = move(ext); m.em.externs.insert(m.externs.begin(), m.externs.end());
+        }
+    }
+
+    void emit() {
+        parallel_for(mods.size(), jobs, [&](size_t i) {
+            Module& m = mods[i]; if (m.cached) return;
+            m.em.cache = cache; m.em.src = m.src; m.em.fold = opt; m.em.regs = regs; m.em.emitUnits(m.ast, innerJobs()); m.preOpt = m.em.textBytes();
+        });
+    }
+    void optimize() { parallel_for(mods.size(), jobs, [&](size_t i) { if (!mods[i].cached) mods[i].em.optimizeUnits(innerJobs()); }); }
+
+    // Concatenates the module images: capsule ids and rodata strings are re-interned program-wide (in module
+    // order, so a single module links to itself unchanged), TEXT addresses rebased, imports patched.
+    Emitter::BuildResult link() {
+        parallel_for(mods.size(), jobs, [&](size_t i) {
+            Module& m = mods[i]; if (m.cached) return;
+            m.br = m.em.link(); m.strs.assign(m.em.strs.strs.begin(), m.em.strs.strs.end()); m.strOff = m.em.strOff; m.nRelocs = m.em.nRelocs; m.naiveBytes = m.em.strs.naiveBytes;
+            if (cache) { BlobW w; saveObject(m, w); cache->store(m.key, ".emm", w.s); }
+        });
+        if (mods.size() == 1) return stubHosts(move(mods[0].br));
+        Emitter::BuildResult out; Interner caps; StrPool strs;
+        vector<vector<uint32_t>> strIds(mods.size());
+        for (size_t i = 0; i < mods.size(); i++) for (auto& str : mods[i].strs) strIds[i].push_back(strs.intern(str));
+        vector<uint32_t> strOff = strs.place(out.rodata);
+        vector<uint32_t> base(mods.size());
+        for (size_t i = 0; i < mods.size(); i++) { base[i] = (uint32_t)out.text.size(); out.text.insert(out.text.end(), mods[i].br.text.begin(), mods[i].br.text.end()); }
+        for (size_t i = 0; i < mods.size(); i++) {
+            Module& m = mods[i]; uint8_t* t = out.text.data() + base[i]; size_t n = m.br.text.size();
+            vector<uint32_t> capIds{ 0 }; for (size_t id = 1; id < m.br.capNames.size(); id++) capIds.push_back(caps.intern(m.br.capNames[id]));
+            unordered_map<uint32_t, uint32_t> roAt; // module rodata offset -> program rodata offset
+            for (size_t id = 0; id < m.strOff.size(); id++) roAt[m.strOff[id]] = strOff[strIds[i][id]];
+            unordered_set<uint32_t> ext; for (auto& r : m.br.unresolved) ext.insert(r.pos);
+            for (size_t pc = 0; pc < n; pc += op_len(t[pc])) {
+                uint8_t op = t[pc]; size_t o = op_target(op);
+                if (o && !ext.count((uint32_t)(pc + o))) { uint32_t a = rd_u32le(&t[pc + o]) + base[i]; memcpy(&t[pc + o], &a, 4); }
+                for (int k = 0; k < op_caps(op); k++) { uint32_t id = capIds[rd_u32le(&t[pc + 1 + 4 * k])]; memcpy(&t[pc + 1 + 4 * k], &id, 4); }
+            }
+            for (uint32_t r : m.br.roRefs) { uint32_t o = roAt.at(rd_u32le(&t[r])); memcpy(&t[r], &o, 4); out.roRefs.push_back(base[i] + r); }
+            for (auto& r : m.br.unresolved) {
+                if (!m.binds.count(r.sym)) { out.unresolved.push_back({ base[i] + r.pos, r.sym }); continue; } // a host name
+                auto& [tm, sym] = m.binds.at(r.sym);
+                auto it = mods[tm].br.syms.find(sym);
+                if (it == mods[tm].br.syms.end()) throw runtime_error("unresolved symbol: " + sym + " (imported from " + mods[tm].name + ")");
+                uint32_t a = base[tm] + it->second; memcpy(&t[r.pos], &a, 4);
+            }
+            for (auto& kv : m.br.syms) out.syms[i ? m.name + "::" + kv.first : kv.first] = base[i] + kv.second;
+        }
+        for (auto& m : mods) for (auto& b : m.binds) { // local names of imported symbols
+            auto it = mods[b.second.first].br.syms.find(b.second.second);
+            if (it != mods[b.second.first].br.syms.end()) out.syms.emplace(b.first, base[b.second.first] + it->second);
+        }
+        out.capNames = caps.table();
+        return stubHosts(move(out));
+    }
+    // What is still unresolved after linking calls a host name: each distinct name gets a one-byte EXIT at the
+    // end of TEXT and a symbol there, which an embedder binds to a C++ function (Vm::bindHost). Unbound, it
+    // returns at once like an empty function.
+    static Emitter::BuildResult stubHosts(Emitter::BuildResult br) {
+        for (auto& r : br.unresolved) {
+            auto it = br.syms.find(r.sym);
+            if (it == br.syms.end()) { it = br.syms.emplace(r.sym, (uint32_t)br.text.size()).first; br.text.push_back(OP_EXIT); }
+            memcpy(&br.text[r.pos], &it->second, 4);
+        }
+        br.unresolved.clear(); return br;
+    }
+
+    size_t tokens() const { size_t n = 0; for (auto& m : mods) n += m.nTokens; return n; }
+    size_t nodes() const { size_t n = 0; for (auto& m : mods) n += m.nNodes; return n; }
+    size_t relocs() const { size_t n = 0; for (auto& m : mods) n += m.nRelocs; return n; }
+    size_t naiveStrBytes() const { size_t n = 0; for (auto& m : mods) n += m.naiveBytes; return n; }
+    size_t textBytes() const { size_t n = 0; for (auto& m : mods) n += m.preOpt; return n; } // as emitted, before the optimizer
+    size_t moduleHits() const { size_t n = 0; for (auto& m : mods) n += m.cached; return n; }
+    size_t unitHits() const { size_t n = 0; for (auto& m : mods) n += m.em.unitHits; return n; }
+    size_t units() const { size_t n = 0; for (auto& m : mods) n += m.em.units.size(); return n; }
+};
+
+//
+// Embedding API (declared in eminor.h)
+//
+struct eminor::Image::Impl {
+    ObjImage obj;
+    template <class... A> explicit Impl(A&&... a) : obj(forward<A>(a)...) {}
+};
+
+eminor::Image eminor::Image::load(const string& path) { return { make_shared<const Impl>(path) }; }
+
+eminor::Image eminor::compile(string_view src, const Options& o) {
+    Program prog; prog.includeDirs = o.includeDirs; prog.jobs = o.jobs; prog.opt = o.opt; prog.regs = o.regs; prog.starRules = o.starRules;
+    prog.diagOut = o.diag; prog.hosts.insert(o.hosts.begin(), o.hosts.end());
+    prog.load(o.path, string(src)); prog.check(); prog.emit();
+    if (o.opt) prog.optimize();
+    string bytes = obj_image(prog.link(), o.compact);
+    return { make_shared<const Image::Impl>(string_view(bytes), o.path) };
+}
+
+int eminor::Runtime::run(const Image& img, const string& entry) const {
+    Vm vm(img.impl->obj, *out, *in); vm.jit = jit;
+    for (auto& kv : hosts) vm.bindHost(kv.first, kv.second);
+    return vm.run(entry, threads);
+}
+
+#ifndef EMINORCC_NO_MAIN // defined by eminor_bench.cpp (which includes this file) and by embedders (see eminor.h)
+//
+// Pass timing (--time-passes) and compile statistics (--stats)
+//
+struct PassTimes {
+    struct Pass { const char* name; long long ns; size_t peakBytes, allocBytes; };
+    vector<Pass> passes;
+    // Times the enclosing scope; a null owner makes it a no-op.
+    struct Scope {
+        PassTimes* pt; const char* name; long long t0 = 0; size_t total0 = 0;
+        Scope(PassTimes* p, const char* n) : pt(p), name(n) {
+            if (!pt) return;
+            HeapStats::resetPeak(); total0 = HeapStats::total.load(); t0 = now_ns();
+        }
+        ~Scope() { if (pt) pt->passes.push_back({ name, now_ns() - t0, HeapStats::peak.load(), HeapStats::total.load() - total0 }); }
+    };
+};
+struct CompileStats {
+    size_t tokens = 0, astNodes = 0, relocs = 0, textBytes = 0, rodataBytes = 0, rodataSavedBytes = 0;
+    long long optRemovedBytes = 0; // negative when the optimizer grew TEXT (loop inversion copies the test)
+    bool cache = false; size_t modules = 0, moduleHits = 0, units = 0, unitHits = 0; // units: of the modules that were compiled
+};
+
+static string stats_json(const PassTimes* pt, const CompileStats* cs) {
+    ostringstream js; js << "{";
+    if (pt) {
+        js << "\n  \"passes\": [";
+        for (size_t i = 0; i < pt->passes.size(); i++) {
+            auto& p = pt->passes[i];
+            js << (i ? "," : "") << "\n    {\"name\": \"" << p.name << "\", \"ms\": " << fixed << setprecision(3) << p.ns / 1e6;
+            if (EMINOR_HEAP_STATS) js << ", \"peak_bytes\": " << p.peakBytes << ", \"alloc_bytes\": " << p.allocBytes;
+            js << "}";
+        }
+        js << "\n  ]" << (cs ? "," : "");
+    }
+    if (cs) {
+        js << "\n  \"stats\": {\"tokens\": " << cs->tokens << ", \"ast_nodes\": " << cs->astNodes << ", \"relocs\": " << cs->relocs
+           << ", \"text_bytes\": " << cs->textBytes << ", \"rodata_bytes\": " << cs->rodataBytes << ", \"rodata_saved_bytes\": " << cs->rodataSavedBytes << ", \"opt_removed_bytes\": " << cs->optRemovedBytes << "}";
+        if (cs->cache) js << ",\n  \"cache\": {\"modules\": " << cs->modules << ", \"module_hits\": " << cs->moduleHits << ", \"units\": " << cs->units << ", \"unit_hits\": " << cs->unitHits << "}";
+    }
+    js << "\n}\n";
+    return js.str();
+}
+
+//
+// CLI driver
+//
+struct Cmd {
+    string inPath, outDir = "out";
+    vector<string> batch;       // several inputs or an @list: each compiles on its own into outDir/<path> (compile_batch)
+    bool wantDisasm = true, wantRun = false, wantOpt = true, timePasses = false, stats = false, execImage = false;
+    unsigned threads = 0; // VM pool size, 0 = hardware threads
+    unsigned jobs = 0;    // compile threads (modules, emit/optimize units), 0 = hardware threads
+    vector<string> includeDirs; // -I: extra @import search roots
+    string cacheDir;            // --cache: reuse unchanged modules and units across runs
+    bool serve = false; string socketPath; // --serve [--socket PATH]: compile requests as JSON lines, defaults from the other flags
+    uint32_t starRules = ~0u;   // --star-rules: which Star-Code checks run
+    bool compact = false;       // --compact: a.emo (and --run) use the compact operand encoding
+    bool regs = false;          // --regs: capsule-to-capsule (three-address) code for call-free expressions
+    bool jit = false;           // --jit: --run/--exec compile hot loops to machine code
+    string disasmSymbol; size_t disasmFrom = 0, disasmTo = SIZE_MAX; // --disasm-symbol / --disasm-range: list only that part
+    string profile;             // --profile PREFIX: --run/--exec write PREFIX.{cpu,ops,wait}.folded
+    vector<string> hosts;       // --host NAME: calls to NAME may stay undefined, for an embedder to bind (eminor.h)
+    bool disasmPart() const { return !disasmSymbol.empty() || disasmFrom || disasmTo != SIZE_MAX; }
+};
+static Cmd parseArgs(int argc, char** argv) {
+    Cmd c;
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a == "-o" && i + 1 < argc) { c.outDir = argv[++i]; }
+        else if (a == "--no-disasm") { c.wantDisasm = false; }
+        else if (a == "--run") { c.wantRun = true; }
+        else if (a == "--exec") { c.execImage = true; }
+        else if (a == "--no-opt") { c.wantOpt = false; }
+        else if (a == "--time-passes") { c.timePasses = true; }
+        else if (a == "--stats") { c.stats = true; }
+        else if (a == "--threads" && i + 1 < argc) { c.threads = (unsigned)stoul(argv[++i]); }
+        else if ((a == "--jobs" || a == "-j") && i + 1 < argc) { c.jobs = (unsigned)stoul(argv[++i]); }
+        else if (a == "-I" && i + 1 < argc) { c.includeDirs.push_back(argv[++i]); }
+        else if (a == "--cache" && i + 1 < argc) { c.cacheDir = argv[++i]; }
+        else if (a == "--serve") { c.serve = true; }
+        else if (a == "--star-rules" && i + 1 < argc) { c.starRules = StarCode::parseRules(argv[++i]); }
+        else if (a == "--socket" && i + 1 < argc) { c.socketPath = argv[++i]; }
+        else if (a == "--compact") { c.compact = true; }
+        else if (a == "--regs") { c.regs = true; }
+        else if (a == "--jit") { c.jit = true; }
+        else if (a == "--profile" && i + 1 < argc) { c.profile = argv[++i]; }
+        else if (a == "--host" && i + 1 < argc) { c.hosts.push_back(argv[++i]); }
+        else if (a == "--disasm-symbol" && i + 1 < argc) { c.disasmSymbol = argv[++i]; }
+        else if (a == "--disasm-range" && i + 1 < argc) { // FROM:TO, byte offsets into TEXT (0x... for hex); either may be empty
+            string r = argv[++i]; size_t k = r.find(':'); if (k == string::npos) throw runtime_error("--disasm-range wants FROM:TO");
+            if (k) c.disasmFrom = stoull(r.substr(0, k), nullptr, 0);
+            if (k + 1 < r.size()) c.disasmTo = stoull(r.substr(k + 1), nullptr, 0);
+        }
+        else if (a.size() > 1 && a[0] == '-') throw runtime_error("unknown arg: " + a);
+        else if (a.size() > 1 && a[0] == '@') { // response file: one input per line, # comments
+            ifstream in(a.substr(1)); if (!in) throw runtime_error("cannot open: " + a.substr(1));
+            for (string l; getline(in, l);) { l = trim(l); if (!l.empty() && l[0] != '#') c.batch.push_back(l); }
+            if (!c.inPath.empty()) { c.batch.insert(c.batch.begin(), c.inPath); c.inPath.clear(); }
+        }
+        else if (c.inPath.empty() && c.batch.empty()) { c.inPath = a; }
+        else { if (!c.inPath.empty()) { c.batch.push_back(c.inPath); c.inPath.clear(); } c.batch.push_back(a); }
+    }
+    if (!c.batch.empty()) {
+        if (c.wantRun || c.execImage || c.serve || c.disasmPart()) throw runtime_error("--run, --exec, --serve and --disasm-* take a single input");
+        c.inPath = c.batch[0]; // for the usage check below
+    }
+    if (c.inPath.empty() && !c.serve) throw runtime_error("usage: eminorcc <input.eminor>... | @list [-o outdir] [-I dir] [--no-disasm] [--no-opt] [--run] [--threads N] [--jobs N] [--cache dir] [--star-rules list] [--compact] [--regs] [--jit] [--time-passes] [--stats]\n"
+                                                          "       [--disasm-symbol name] [--disasm-range from:to] [--profile prefix] [--host name]\n"
+                                                          "       eminorcc --exec <a.emo> [--threads N] [--jit] [--profile prefix] [--time-passes]\n"
+                                                          "       eminorcc <a.emo> --disasm-symbol name | --disasm-range from:to\n"
+                                                          "       eminorcc --serve [--socket path] [-I dir] [--no-disasm] [--no-opt] [--jobs N] [--cache dir] [--compact] [--regs]");
+    return c;
+}
+
+// The TEXT range [from, to) that --disasm-symbol / --disasm-range select. A symbol runs to the next start above it.
+template <class Lookup> static pair<size_t, size_t> disasm_window(const Cmd& cmd, const vector<uint32_t>& starts, size_t n, Lookup sym) {
+    size_t from = cmd.disasmFrom, to = cmd.disasmTo;
+    if (!cmd.disasmSymbol.empty()) {
+        long long v = sym(cmd.disasmSymbol); if (v < 0) throw runtime_error("--disasm-symbol: no symbol " + cmd.disasmSymbol);
+        auto it = upper_bound(starts.begin(), starts.end(), (uint32_t)v);
+        from = max(from, (size_t)v); to = min(to, it == starts.end() ? n : (size_t)*it);
+    }
+    return { from, min(to, n) };
+}
+
+// Compiles cmd.inPath and everything it imports, writes the artifacts under cmd.outDir and returns their paths.
+// prog belongs to the caller so its diagnostics outlive a failed build.
+static vector<string> compile_files(const Cmd& cmd, Program& prog, PassTimes* pt, CompileStats& cs, Emitter::BuildResult& build) {
+    string src; { PassTimes::Scope ps(pt, "read"); src = read_file(cmd.inPath); }
+
+    // Parse the root module and everything it imports (sources outlive the ASTs: node strings view them)
+    BuildCache cache{ cmd.cacheDir };
+    prog.includeDirs = cmd.includeDirs; prog.jobs = cmd.jobs; prog.opt = cmd.wantOpt; prog.regs = cmd.regs; prog.starRules = cmd.starRules; prog.cache = cmd.cacheDir.empty() ? nullptr : &cache;
+    prog.hosts.insert(cmd.hosts.begin(), cmd.hosts.end());
+    { PassTimes::Scope s(pt, "parse"); prog.load(cmd.inPath, move(src)); }
+
+    // Star-Code validations, import binding
+    { PassTimes::Scope s(pt, "starcode"); prog.check(); }
+
+    // Emit IR, optimize and link (modules in parallel; within a module, units spread over --jobs threads)
+    { PassTimes::Scope s(pt, "emit"); prog.emit(); }
+    size_t preOpt = prog.textBytes();
+    if (cmd.wantOpt) { PassTimes::Scope s(pt, "optimize"); prog.optimize(); }
+    { PassTimes::Scope s(pt, "link"); build = prog.link(); }
+    cs.tokens = prog.tokens(); cs.astNodes = prog.nodes(); cs.relocs = prog.relocs(); cs.rodataSavedBytes = prog.naiveStrBytes() - build.rodata.size();
+    cs.optRemovedBytes = (long long)preOpt - (long long)build.text.size(); cs.textBytes = build.text.size(); cs.rodataBytes = build.rodata.size();
+    cs.cache = prog.cache; prog.cache = nullptr; cs.modules = prog.mods.size(); cs.moduleHits = prog.moduleHits(); cs.units = prog.units(); cs.unitHits = prog.unitHits();
+
+    // Output files
+    string base = (filesystem::path(cmd.outDir) / "a").string(); vector<string> files;
+    auto put = [&](const string& path, string_view data) { write_file(path, data); files.push_back(path); };
+    {
+        PassTimes::Scope s(pt, "write");
+        put(base + ".ir.bin", string_view((const char*)build.text.data(), build.text.size()));
+        write_hex(base + ".text.hex", build.text.data(), build.text.size()); files.push_back(base + ".text.hex");
+        put(base + ".rodata.bin", string_view((const char*)build.rodata.data(), build.rodata.size()));
+        put(base + ".emo", obj_image(build, cmd.compact));
         // symbols
         {
             ostringstream js; js << "{\n  \"functions\": {";
-            bool first = true;
-            for (auto& kv : build.syms) { if (!first) js << ","; first = false; js << "\n    \"" << kv.first << "\": " << kv.second; }
+            bool first = true; map<string, uint32_t> byName(build.syms.begin(), build.syms.end()); // independent of hash order
+            for (auto& kv : byName) { if (!first) js << ","; first = false; js << "\n    \"" << kv.first << "\": " << kv.second; }
+            js << "\n  }\n}\n";
+            put((filesystem::path(cmd.outDir) / "symbols.json").string(), js.str());
+        }
+        // capsule/channel/thread ids (dense, in id order)
+        {
+            ostringstream js; js << "{\n  \"capsules\": {";
+            for (size_t id = 1; id < build.capNames.size(); id++) js << (id > 1 ? "," : "") << "\n    \"" << build.capNames[id] << "\": " << id;
             js << "\n  }\n}\n";
-            write_file((filesystem::path(cmd.outDir) / "symbols.json").string(), js.str());
+            put((filesystem::path(cmd.outDir) / "capsules.json").string(), js.str());
+        }
+    }
+    if (cmd.wantDisasm) {
+        PassTimes::Scope s(pt, "disasm");
+        string path = base + ".dis.txt"; size_t n = build.text.size();
+        auto starts = disasm_starts(build.syms.begin(), build.syms.end(), n);
+        if (!cmd.disasmPart()) write_disasm(path, build.text.data(), n, starts, cmd.jobs);
+        else {
+            auto w = disasm_window(cmd, starts, n, [&](const string& y) { auto it = build.syms.find(y); return it == build.syms.end() ? -1LL : it->second; });
+            ofstream f(path, ios::binary); if (!f) throw runtime_error("cannot write: " + path);
+            OutBuf o(f); disasm(o, build.text.data(), n, w.first, w.second, &starts);
+        }
+        files.push_back(path);
+    }
+    return files;
+}
+
+// Output directory of one batch input: outDir plus the input's path without extension, root, "." and ".." parts.
+static string batch_out(const string& outDir, const string& in) {
+    filesystem::path p = filesystem::path(in).relative_path(), r; p.replace_extension();
+    for (auto& part : p) if (part != ".." && part != ".") r /= part;
+    return (filesystem::path(outDir) / r).string();
+}
+
+// Batch mode: every input is its own build (imports included) into batch_out(), spread over --jobs threads; each
+// thread rewinds one set of parse arenas from file to file. A file's diagnostics are held until every file before
+// it has been reported, so the log is in input order whatever the schedule. Returns 1 if any file failed.
+static int compile_batch(const Cmd& cmd) {
+    struct Done { string log; bool ok = false, ready = false; };
+    size_t n = cmd.batch.size(), printed = 0, failed = 0; vector<Done> done(n); mutex mu;
+    vector<string> outs(n); unordered_map<string, size_t> byOut; // two inputs writing one directory would race
+    for (size_t i = 0; i < n; i++) {
+        outs[i] = batch_out(cmd.outDir, cmd.batch[i]);
+        auto [it, fresh] = byOut.emplace(filesystem::path(outs[i]).lexically_normal().generic_string(), i);
+        if (!fresh) throw runtime_error(cmd.batch[it->second] + " and " + cmd.batch[i] + " both write " + outs[i]);
+    }
+    parallel_for(n, cmd.jobs, [&](size_t i) {
+        thread_local deque<Arena> arenas;
+        const string& in = cmd.batch[i]; ostringstream log; bool ok = true;
+        Program prog; prog.diagOut = nullptr; prog.arenas = &arenas;
+        try {
+            Cmd c = cmd; c.batch.clear(); c.inPath = in; c.outDir = outs[i]; c.jobs = 1; // files are the parallelism
+            CompileStats cs; Emitter::BuildResult build; compile_files(c, prog, nullptr, cs, build);
+        }
+        catch (const exception& e) { ok = false; log << "fatal: " << in << ": " << e.what() << "\n"; }
+        string head = log.str(); log.str("");
+        for (auto& d : prog.reported) log << in << ": " << d.kind << ": " << d.msg << " @" << d.at << "\n";
+        lock_guard<mutex> lk(mu);
+        done[i].log = log.str() + head; done[i].ok = ok; done[i].ready = true;
+        for (; printed < n && done[printed].ready; printed++) { cerr << done[printed].log; failed += !done[printed].ok; string().swap(done[printed].log); }
+    });
+    if (failed) { cerr << "error: " << failed << " of " << n << " files failed\n"; return 1; }
+    cerr << "ok: wrote " << n << " files under " << cmd.outDir << "\n";
+    return 0;
+}
+
+//
+// Compile server (--serve): one JSON request per line on stdin, or per line on each connection to --socket PATH
+//   request   {"id": 7, "input": "app/main.eminor", "out": "out", "include": ["lib"], "cache": ".cache",
+//              "opt": true, "disasm": false, "jobs": 0, "star_rules": "all", "compact": false, "regs": false,
+//              "stats": false}   (all but "input" optional)
+//             {"shutdown": true} ends the session (the whole server for --socket)
+//   response  {"id": 7, "ok": true, "ms": 1.250, "diagnostics": [{"kind": "warning", "msg": "...", "at": "3:5"}],
+//              "artifacts": ["out/a.ir.bin", ...], "stats": {...}}
+//             {"id": 7, "ok": false, "error": "...", "diagnostics": [...]}
+//   Missing fields take the server's command-line flags. Each connection keeps its own parser arenas warm; capsule
+//   and string interners stay per build, since ids must be dense and in first-use order for the output to match.
+//
+static string json_str(string_view v) {
+    string o = "\"";
+    for (unsigned char c : v) {
+        if (c == '"' || c == '\\') { o += '\\'; o += (char)c; }
+        else if (c == '\n') o += "\\n"; else if (c == '\t') o += "\\t"; else if (c == '\r') o += "\\r";
+        else if (c < 0x20) { char b[8]; snprintf(b, sizeof b, "\\u%04x", c); o += b; }
+        else o += (char)c;
+    }
+    return o + "\"";
+}
+
+// One request line: a flat object of strings, numbers, booleans and string arrays (raw keeps the value's text).
+struct JsonReq {
+    struct Val { string s, raw; bool b = false; vector<string> list; };
+    map<string, Val> kv;
+
+    explicit JsonReq(string_view t) {
+        size_t i = 0;
+        auto bad = [&](const char* what) -> runtime_error { return runtime_error(string("request: ") + what + " at byte " + to_string(i)); };
+        auto ws = [&] { while (i < t.size() && isspace((unsigned char)t[i])) i++; };
+        auto expect = [&](char c) { ws(); if (i >= t.size() || t[i] != c) throw bad("expected ','/':'/brace"); i++; };
+        auto str = [&]() -> string {
+            ws(); if (i >= t.size() || t[i] != '"') throw bad("expected string");
+            string o;
+            for (i++; ; i++) {
+                if (i >= t.size()) throw bad("unterminated string");
+                char c = t[i]; if (c == '"') { i++; return o; }
+                if (c != '\\') { o += c; continue; }
+                if (++i >= t.size()) throw bad("unterminated string");
+                switch (t[i]) {
+                case 'n': o += '\n'; break; case 't': o += '\t'; break; case 'r': o += '\r'; break;
+                case 'b': o += '\b'; break; case 'f': o += '\f'; break;
+                case 'u': {
+                    if (i + 4 >= t.size()) throw bad("bad \\u escape");
+                    unsigned cp = (unsigned)stoul(string(t.substr(i + 1, 4)), nullptr, 16); i += 4;
+                    if (cp < 0x80) o += (char)cp;
+                    else if (cp < 0x800) { o += (char)(0xC0 | cp >> 6); o += (char)(0x80 | (cp & 0x3F)); }
+                    else { o += (char)(0xE0 | cp >> 12); o += (char)(0x80 | (cp >> 6 & 0x3F)); o += (char)(0x80 | (cp & 0x3F)); }
+                    break;
+                }
+                default: o += t[i];
+                }
+            }
+        };
+        expect('{'); ws();
+        if (i < t.size() && t[i] == '}') { i++; return; }
+        for (;;) {
+            string k = str(); expect(':'); ws();
+            Val v; size_t b = i;
+            if (i < t.size() && t[i] == '"') v.s = str();
+            else if (i < t.size() && t[i] == '[') {
+                i++; ws();
+                if (i < t.size() && t[i] == ']') i++;
+                else for (;;) { v.list.push_back(str()); ws(); if (i < t.size() && t[i] == ']') { i++; break; } expect(','); }
+            }
+            else if (t.substr(i, 4) == "true") { v.b = true; i += 4; }
+            else if (t.substr(i, 5) == "false") i += 5;
+            else if (t.substr(i, 4) == "null") i += 4;
+            else {
+                while (i < t.size() && (isdigit((unsigned char)t[i]) || (t[i] && strchr("+-.eE", t[i])))) i++;
+                if (i == b) throw bad("bad value");
+                v.s = string(t.substr(b, i - b));
+            }
+            v.raw = string(t.substr(b, i - b)); kv[k] = move(v);
+            ws(); if (i < t.size() && t[i] == '}') { i++; break; }
+            expect(',');
+        }
+        ws(); if (i != t.size()) throw bad("trailing characters");
+    }
+    const Val* get(const string& k) const { auto it = kv.find(k); return it == kv.end() ? nullptr : &it->second; }
+};
+
+struct Server {
+    Cmd defaults; deque<Arena> arenas; // arenas: module parse arenas, rewound and reused by every request
+    bool stop = false;
+
+    string handle(const string& line) {
+        long long t0 = now_ns(); string id = "null"; Program prog; prog.diagOut = nullptr; prog.arenas = &arenas;
+        ostringstream out; string error; vector<string> files; CompileStats cs; bool stats = false;
+        try {
+            JsonReq rq(line);
+            if (auto v = rq.get("id")) id = v->raw;
+            if (auto v = rq.get("shutdown"); v && v->b) { stop = true; return "{\"id\": " + id + ", \"ok\": true}"; }
+            Cmd c = defaults;
+            if (auto v = rq.get("input")) c.inPath = v->s; else throw runtime_error("request: missing \"input\"");
+            if (auto v = rq.get("out")) c.outDir = v->s;
+            if (auto v = rq.get("include")) c.includeDirs = v->list;
+            if (auto v = rq.get("cache")) c.cacheDir = v->s;
+            if (auto v = rq.get("opt")) c.wantOpt = v->b;
+            if (auto v = rq.get("disasm")) c.wantDisasm = v->b;
+            if (auto v = rq.get("compact")) c.compact = v->b;
+            if (auto v = rq.get("regs")) c.regs = v->b;
+            if (auto v = rq.get("jobs")) c.jobs = (unsigned)stoul(v->s);
+            if (auto v = rq.get("stats")) stats = v->b;
+            if (auto v = rq.get("star_rules")) c.starRules = StarCode::parseRules(v->s);
+            Emitter::BuildResult build; files = compile_files(c, prog, nullptr, cs, build);
+        }
+        catch (const exception& e) { error = e.what(); }
+        out << "{\"id\": " << id << ", \"ok\": " << (error.empty() ? "true" : "false") << ", \"ms\": " << fixed << setprecision(3) << (now_ns() - t0) / 1e6;
+        if (!error.empty()) out << ", \"error\": " << json_str(error);
+        out << ", \"diagnostics\": [";
+        for (size_t i = 0; i < prog.reported.size(); i++) {
+            auto& d = prog.reported[i];
+            out << (i ? ", " : "") << "{\"kind\": " << json_str(d.kind) << ", \"msg\": " << json_str(d.msg) << ", \"at\": " << json_str(d.at) << "}";
+        }
+        out << "]";
+        if (error.empty()) {
+            out << ", \"artifacts\": ["; for (size_t i = 0; i < files.size(); i++) out << (i ? ", " : "") << json_str(files[i]); out << "]";
+            if (stats) { // stats_json's "stats"/"cache" members, on one line
+                string js = stats_json(nullptr, &cs), flat; js = js.substr(js.find('{') + 1); js.resize(js.rfind('}'));
+                bool nl = false;
+                for (char ch : js) { if (ch == '\n') nl = true; else if (!(nl && ch == ' ')) { if (nl) flat += ' '; nl = false; flat += ch; } }
+                out << "," << flat;
+            }
+        }
+        out << "}";
+        return out.str();
+    }
+
+    // Requests from in until EOF or shutdown, each answered by one line on out.
+    void serve(istream& in, ostream& out) {
+        for (string line; !stop && getline(in, line);) {
+            if (line.find_first_not_of(" \t\r") == string::npos) continue;
+            out << handle(line) << "\n" << flush;
+        }
+    }
+};
+
+#if !defined(_WIN32)
+// --socket: a thread per connection, each with its own Server; a shutdown request closes the listener.
+static void serve_socket(const Cmd& cmd) {
+    sockaddr_un addr{}; addr.sun_family = AF_UNIX;
+    if (cmd.socketPath.size() >= sizeof addr.sun_path) throw runtime_error("socket path too long: " + cmd.socketPath);
+    memcpy(addr.sun_path, cmd.socketPath.c_str(), cmd.socketPath.size() + 1);
+    int ls = socket(AF_UNIX, SOCK_STREAM, 0); if (ls < 0) throw runtime_error("socket: " + string(strerror(errno)));
+    unlink(cmd.socketPath.c_str());
+    if (bind(ls, (const sockaddr*)&addr, sizeof addr) < 0 || listen(ls, 64) < 0) { string e = strerror(errno); close(ls); throw runtime_error("cannot listen on " + cmd.socketPath + ": " + e); }
+    cerr << "ok: serving on " << cmd.socketPath << "\n";
+    atomic<bool> down{ false };
+    for (;;) {
+        int c = accept(ls, nullptr, nullptr);
+        if (c < 0) { if (down) break; if (errno == EINTR || errno == ECONNABORTED) continue; throw runtime_error("accept: " + string(strerror(errno))); }
+        thread([c, &cmd, &down, ls] {
+            Server sv; sv.defaults = cmd; string buf; char chunk[4096];
+            auto reply = [&](const string& r) {
+                string s = r + "\n";
+#ifdef MSG_NOSIGNAL
+                const int flags = MSG_NOSIGNAL;
+#else
+                const int flags = 0;
+#endif
+                for (size_t o = 0; o < s.size();) { ssize_t n = send(c, s.data() + o, s.size() - o, flags); if (n <= 0) return false; o += (size_t)n; }
+                return true;
+            };
+            for (bool open = true; open && !sv.stop;) {
+                ssize_t n = recv(c, chunk, sizeof chunk, 0); if (n <= 0) break;
+                buf.append(chunk, (size_t)n);
+                for (size_t nl; open && !sv.stop && (nl = buf.find('\n')) != string::npos; buf.erase(0, nl + 1)) {
+                    string line = buf.substr(0, nl);
+                    if (line.find_first_not_of(" \t\r") != string::npos) open = reply(sv.handle(line));
+                }
+            }
+            close(c);
+            if (sv.stop && !down.exchange(true)) shutdown(ls, SHUT_RDWR); // wakes the accept loop
+        }).detach();
+    }
+    close(ls); unlink(cmd.socketPath.c_str());
+}
+#endif
+
+int main(int argc, char** argv) {
+    ios::sync_with_stdio(false);
+    try {
+        Cmd cmd = parseArgs(argc, argv);
+        PassTimes times; PassTimes* pt = cmd.timePasses ? &times : nullptr;
+        CompileStats cs;
+        if (cmd.serve) {
+            if (cmd.socketPath.empty()) { Server sv; sv.defaults = cmd; sv.serve(cin, cout); return 0; }
+#if !defined(_WIN32)
+            serve_socket(cmd); return 0;
+#else
+            throw runtime_error("--socket needs a POSIX system; use --serve on stdin");
+#endif
+        }
+        if (!cmd.batch.empty()) return compile_batch(cmd);
+        if (cmd.disasmPart() && filesystem::path(cmd.inPath).extension() == ".emo") { // list part of an image, no compile
+            ObjImage img(cmd.inPath);
+            if (img.compact()) throw runtime_error("--disasm-*: " + cmd.inPath + " is a compact image; list the default (wide) form");
+            vector<pair<string_view, uint32_t>> ys; for (uint32_t k = 0; k < img.hdr().nSyms; k++) ys.push_back({ img.symName(img.syms()[k]), img.syms()[k].value });
+            size_t n = img.secSize(SEC_TEXT); auto starts = disasm_starts(ys.begin(), ys.end(), n);
+            auto w = disasm_window(cmd, starts, n, [&](const string& y) { const ObjSym* s = img.find(y); return s ? (long long)s->value : -1LL; });
+            OutBuf o(cout); disasm(o, img.sec(SEC_TEXT), n, w.first, w.second, &starts);
+            return 0;
         }
-        if (cmd.wantDisasm) {
-            write_file(base + ".dis.txt", disasm(build.text));
+        if (cmd.execImage) { // run a previously written image without compiling
+            int rc = 0;
+            {
+                unique_ptr<ObjImage> img; { PassTimes::Scope s(pt, "load"); img = make_unique<ObjImage>(cmd.inPath); }
+                PassTimes::Scope s(pt, "run"); Vm vm(*img); vm.jit = cmd.jit; vm.profile = cmd.profile; rc = vm.run("@main", cmd.threads); cout.flush();
+            }
+            if (pt) cerr << stats_json(pt, nullptr);
+            return rc;
         }
+        Program prog; Emitter::BuildResult build;
+        compile_files(cmd, prog, pt, cs, build);
 
         cerr << "ok: wrote " << cmd.outDir << "\n";
-        return 0;
+        int rc = 0;
+        if (cmd.wantRun) { PassTimes::Scope s(pt, "run"); Vm vm(build, cmd.compact); vm.jit = cmd.jit; vm.profile = cmd.profile; rc = vm.run("@main", cmd.threads); cout.flush(); }
+        if (pt || cmd.stats) cerr << stats_json(pt, cmd.stats ? &cs : nullptr);
+        return rc;
     }
     catch (const exception& e) {
         cerr << "fatal: " << e.what() << "\n"; return 1;
     }
 }
+#endif
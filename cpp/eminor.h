@@ -0,0 +1,69 @@
+/*
+  eminor.h - embedding API of the E Minor compiler and VM
+  -------------------------------------------------------
+  Build GCC_Compiler.cpp as its own translation unit with EMINORCC_NO_MAIN defined and link it into the host:
+
+    g++ -std=gnu++17 -O2 -pthread -DEMINORCC_NO_MAIN -c GCC_Compiler.cpp -o eminor.o
+    g++ -std=gnu++17 -O2 -pthread host.cpp eminor.o -o host
+
+  compile() turns source into an Image in memory, or Image::load() maps an a.emo; Runtime::run() then runs it as
+  often as needed without touching the disk, each run on a fresh VM over the shared image. A #call to a name
+  registered with Runtime::host runs that C++ function instead of E-Minor code:
+
+    eminor::Options o; o.hosts = { "$render" };           // may be called without a definition
+    eminor::Image img = eminor::compile(src, o);
+    eminor::Runtime rt; rt.host("$render", 1, [](const long long* a, size_t) { draw(a[0]); return 0LL; });
+    for (;;) rt.run(img);
+
+  Errors (syntax, Star-Code, link, VM trap) are thrown as std::runtime_error, as the CLI reports them.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace eminor {
+
+struct Options {
+    std::string path = "<source>"; // names the root module; its imports resolve from its directory, then includeDirs
+    std::vector<std::string> includeDirs;
+    std::vector<std::string> hosts; // names #call may use without a definition (as --host)
+    bool opt = true, regs = false, compact = false; uint32_t starRules = ~0u; unsigned jobs = 0; // as the CLI flags
+    std::ostream* diag = &std::cerr; // Star-Code findings; null drops them (errors still throw)
+};
+
+// A linked and validated object image; copies share it.
+struct Image {
+    struct Impl; std::shared_ptr<const Impl> impl;
+    static Image load(const std::string& path); // mapped, as --exec does
+};
+
+Image compile(std::string_view src, const Options& o = {});
+
+// A C++ function standing in for the E-Minor function of its name: a call hands it the argc values the caller
+// pushed, first argument first; with ret its result is pushed, as `return expr;` would. Pool threads may call
+// it concurrently.
+struct Host { std::function<long long(const long long* args, size_t argc)> fn; uint32_t argc = 0; bool ret = false; };
+
+// Host functions and run settings, reused across runs and images.
+struct Runtime {
+    unsigned threads = 1; bool jit = false; // as --threads / --jit
+    std::ostream* out = &std::cout; std::istream* in = &std::cin;
+    std::unordered_map<std::string, Host> hosts;
+
+    Runtime& host(const std::string& name, uint32_t argc, std::function<long long(const long long*, size_t)> fn, bool ret = false) {
+        hosts[name] = { std::move(fn), argc, ret }; return *this;
+    }
+    // Returns the exit status (0, or the largest #error code raised, clamped to 255); a VM trap or a host
+    // function's exception propagates. Hosts the image never calls are skipped.
+    int run(const Image& img, const std::string& entry = "@main") const;
+};
+
+} // namespace eminor
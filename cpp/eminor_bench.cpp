@@ -0,0 +1,202 @@
+/*
+  eminor_bench - synthetic corpus generator and per-phase throughput bench for the eminorcc pipeline
+  ---------------------------------------------------------------------------------------------------
+  Build:     g++ -std=gnu++17 -O2 -pthread eminor_bench.cpp -o eminor_bench
+             cl /std:c++17 /EHsc /O2 eminor_bench.cpp /Fe:eminor_bench.exe
+
+  Usage:     eminor_bench [input.eminor] [--funcs N] [--stmts N] [--depth N] [--strings P] [--gotos N]
+                          [--style short|long|mixed] [--seed N] [--emit path] [--min-ms N] [--json]
+
+  Without an input file a program is generated from the knobs (same seed -> same program):
+    --funcs    functions (plus one @main that calls each of them)       default 200
+    --stmts    statements per block                                     default 12
+    --depth    maximum nesting of if/loop blocks                        default 3
+    --strings  fraction of statements that carry a string literal, 0-1 default 0.2
+    --gotos    forward goto/label pairs per function                    default 2
+    --style    shortcode (#if/#loop/#load), long-form (if/loop/assign/print) or a mix
+  --emit writes the generated program and exits. Each phase is repeated for at least --min-ms
+  (default 300) and the fastest run is reported as source MB/s and AST nodes/s.
+*/
+
+#define EMINORCC_NO_MAIN
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function" // driver-only helpers (disasm, dump_hex, parseArgs, ...)
+#endif
+#include "GCC_Compiler.cpp"
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+//
+// Corpus generator
+//
+struct GenOpts {
+    size_t funcs = 200, stmts = 12, depth = 3, gotos = 2; double strings = 0.2;
+    enum class Style { Short, Long, Mixed } style = Style::Mixed; uint64_t seed = 1;
+};
+
+struct Gen {
+    GenOpts o; uint64_t rng; ostringstream out; size_t fn = 0, label = 0;
+    explicit Gen(const GenOpts& opts) : o(opts), rng(opts.seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    uint64_t next() { rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17; return rng; }
+    size_t pick(size_t n) { return (size_t)(next() % n); }
+    bool chance(double p) { return (double)(next() >> 11) / 9007199254740992.0 < p; }
+    bool longForm() { return o.style == GenOpts::Style::Long || (o.style == GenOpts::Style::Mixed && chance(0.5)); }
+    void ind(size_t d) { for (size_t i = 0; i < d; i++) out << "  "; }
+
+    string cap() { return "$c" + to_string(pick(16)); }
+    string str() {
+        static const char* words[] = { "alpha", "beta", "gamma", "delta", "packet", "lease", "stamp", "queue" };
+        string s = "\"";
+        for (size_t i = 0, n = 1 + pick(4); i < n; i++) s += string(i ? " " : "") + words[pick(8)];
+        if (chance(0.2)) s += "\\n";
+        return s + "\"";
+    }
+    string expr(size_t d = 0) {
+        static const char* ops[] = { "+", "-", "*", "/", "%", "<", ">", "<=", ">=", "==", "!=", "&&", "||" };
+        switch (d > 2 ? pick(2) : pick(5)) {
+        case 0: return to_string(pick(1000));
+        case 1: return cap();
+        case 2: return "(" + expr(d + 1) + " " + ops[pick(13)] + " " + expr(d + 1) + ")";
+        case 3: return string(pick(2) ? "!" : "-") + expr(d + 1);
+        default: return expr(d + 1) + " " + ops[pick(5)] + " " + expr(d + 1);
+        }
+    }
+
+    string cond() { static const char* rel[] = { "<", ">", "<=", ">=", "==", "!=" }; return expr(1) + " " + rel[pick(6)] + " " + expr(1); }
+
+    void stmt(size_t d, size_t depth) {
+        size_t k = pick(depth < o.depth ? 6 : 4);
+        bool lf = longForm();
+        if (chance(o.strings)) { // string-literal statement
+            ind(d); if (lf) out << "print " << str() << ";\n"; else out << "#load " << cap() << ", " << str() << "\n";
+            return;
+        }
+        switch (k) {
+        case 0: case 1: ind(d); if (lf) out << "assign value " << expr() << " to " << cap() << "\n"; else out << "#load " << cap() << ", " << expr() << "\n"; break;
+        case 2: ind(d); if (lf) out << "print " << expr() << ";\n"; else out << "#output " << cap() << "\n"; break;
+        case 3: ind(d); out << (lf ? "initialize " : "#init ") << cap() << "\n"; break;
+        case 4: // if / else
+            ind(d); out << (lf ? "if (" : "#if (") << cond() << ") {\n"; block(d + 1, depth + 1);
+            ind(d); out << "}";
+            if (chance(0.5)) { out << (lf ? " else {\n" : " #else {\n"); block(d + 1, depth + 1); ind(d); out << "}"; }
+            out << (lf ? "\n" : " #endif\n");
+            break;
+        default: // loop
+            ind(d); out << (lf ? "loop (" : "#loop (") << cap() << " < " << pick(100) << ") {\n"; block(d + 1, depth + 1);
+            ind(d); out << "}\n";
+            break;
+        }
+    }
+    void block(size_t d, size_t depth) { for (size_t i = 0, n = 1 + pick(o.stmts); i < n; i++) stmt(d, depth); }
+
+    string program() {
+        for (fn = 0; fn < o.funcs; fn++) {
+            out << "function $f" << fn << "(a, b) {\n";
+            vector<string> pend; // labels whose goto is already out, placed later in the body
+            for (size_t i = 0; i < o.stmts; i++) {
+                if (pend.size() < o.gotos && chance(0.3)) { string l = ":f" + to_string(fn) + "_l" + to_string(label++); out << "  goto " << l << ";\n"; pend.push_back(l); }
+                stmt(1, 0);
+                if (!pend.empty() && chance(0.4)) { out << "  " << pend.back() << "\n"; pend.pop_back(); }
+            }
+            while (pend.size() < o.gotos) { string l = ":f" + to_string(fn) + "_l" + to_string(label++); out << "  goto " << l << ";\n"; pend.push_back(l); }
+            for (auto& l : pend) out << "  " << l << "\n";
+            out << "  return a + b;\n}\n";
+        }
+        out << "@main {\n";
+        for (size_t i = 0; i < o.funcs; i++) out << "  #load $r, $f" << i << "(" << i << ", " << pick(100) << ")\n";
+        out << "  #exit\n}\n";
+        return out.str();
+    }
+};
+
+//
+// Bench
+//
+struct PhaseResult { const char* name; double bestNs; size_t runs; };
+
+// Runs f until minNs has elapsed (at least twice) and returns the fastest run. prep is untimed.
+template <class Prep, class F> static PhaseResult bench_phase(const char* name, long long minNs, Prep prep, F f) {
+    PhaseResult r{ name, 1e300, 0 };
+    for (long long t0 = now_ns(); r.runs < 2 || now_ns() - t0 < minNs; r.runs++) {
+        prep(); long long a = now_ns(); f(); double d = (double)(now_ns() - a);
+        if (d < r.bestNs) r.bestNs = d;
+    }
+    return r;
+}
+
+static volatile size_t g_sink; // keeps results observable
+
+int main(int argc, char** argv) {
+    ios::sync_with_stdio(false);
+    try {
+        GenOpts g; string inPath, emitPath; long long minMs = 300; bool json = false;
+        for (int i = 1; i < argc; i++) {
+            string a = argv[i];
+            auto val = [&]() -> string { if (i + 1 >= argc) throw runtime_error("missing value for " + a); return argv[++i]; };
+            if (a == "--funcs") g.funcs = stoul(val());
+            else if (a == "--stmts") g.stmts = max<size_t>(1, stoul(val()));
+            else if (a == "--depth") g.depth = stoul(val());
+            else if (a == "--strings") g.strings = stod(val());
+            else if (a == "--gotos") g.gotos = stoul(val());
+            else if (a == "--seed") g.seed = stoull(val());
+            else if (a == "--style") {
+                string s = val();
+                if (s == "short") g.style = GenOpts::Style::Short; else if (s == "long") g.style = GenOpts::Style::Long;
+                else if (s == "mixed") g.style = GenOpts::Style::Mixed; else throw runtime_error("unknown style: " + s);
+            }
+            else if (a == "--emit") emitPath = val();
+            else if (a == "--min-ms") minMs = stoll(val());
+            else if (a == "--json") json = true;
+            else if (inPath.empty() && a[0] != '-') inPath = a;
+            else throw runtime_error("unknown arg: " + a);
+        }
+        string src = inPath.empty() ? Gen(g).program() : read_file(inPath);
+        if (!emitPath.empty()) { write_file(emitPath, src); cerr << "ok: wrote " << emitPath << " (" << src.size() << " bytes)\n"; return 0; }
+
+        // One reference pass for the counts and the inputs of the later phases.
+        Arena refArena; Parser refParser(src, refArena); Node* ast = refParser.parse();
+        size_t nodes = refParser.nNodes, tokens = refParser.nTokens;
+        Emitter refEm; Emitter::BuildResult built = refEm.build(ast);
+        long long minNs = minMs * 1000000LL;
+        vector<PhaseResult> rs;
+
+        rs.push_back(bench_phase("lexer", minNs, [] {}, [&] {
+            Arena a; Lexer lx(src, a); size_t n = 0;
+            for (Token t = lx.next(); t.kind != Tok::End; t = lx.next()) { if (t.kind == Tok::Error) throw runtime_error("lex error"); n++; }
+            g_sink = n;
+        }));
+        rs.push_back(bench_phase("parser", minNs, [] {}, [&] { Arena a; Parser p(src, a); g_sink = (size_t)p.parse(); })); // includes lexing
+        rs.push_back(bench_phase("starcode", minNs, [] {}, [&] { StarCode sc; sc.run(ast); g_sink = sc.diags.size(); }));
+        rs.push_back(bench_phase("emitter", minNs, [] {}, [&] { Emitter em; g_sink = em.build(ast).text.size(); }));
+        Emitter::BuildResult work;
+        rs.push_back(bench_phase("optimizer", minNs, [&] { work = built; }, [&] { Optimizer::peephole(work); g_sink = work.text.size(); }));
+
+        double mb = (double)src.size() / 1e6;
+        if (json) {
+            cout << "{\n  \"input\": {\"bytes\": " << src.size() << ", \"tokens\": " << tokens << ", \"ast_nodes\": " << nodes
+                 << ", \"text_bytes\": " << built.text.size() << "},\n  \"phases\": [";
+            for (size_t i = 0; i < rs.size(); i++) {
+                double s = rs[i].bestNs / 1e9;
+                cout << (i ? "," : "") << "\n    {\"name\": \"" << rs[i].name << "\", \"best_ms\": " << fixed << setprecision(3) << rs[i].bestNs / 1e6
+                     << ", \"runs\": " << rs[i].runs << ", \"mb_per_s\": " << setprecision(2) << mb / s << ", \"nodes_per_s\": " << setprecision(0) << nodes / s << "}";
+            }
+            cout << "\n  ]\n}\n";
+        }
+        else {
+            cout << "input: " << src.size() << " bytes, " << tokens << " tokens, " << nodes << " AST nodes, " << built.text.size() << " text bytes\n";
+            cout << left << setw(11) << "phase" << right << setw(11) << "best ms" << setw(7) << "runs" << setw(11) << "MB/s" << setw(14) << "Mnodes/s" << "\n";
+            for (auto& r : rs) {
+                double s = r.bestNs / 1e9;
+                cout << left << setw(11) << r.name << right << fixed << setprecision(3) << setw(11) << r.bestNs / 1e6 << setw(7) << r.runs
+                     << setprecision(1) << setw(11) << mb / s << setprecision(2) << setw(14) << nodes / s / 1e6 << "\n";
+            }
+        }
+        return 0;
+    }
+    catch (const exception& e) {
+        cerr << "fatal: " << e.what() << "\n"; return 1;
+    }
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+# Regression programs: runs every tests/*.eminor with --run in each mode below and compares stdout with
+# NAME.expected (stdin from NAME.in, exit status from NAME.status, 0 when absent), then checks that --cache
+# builds are byte-identical cold, warm and without the cache. Modules under lib/ are found through -I.
+#   usage: tests/run.sh [path/to/eminorcc]   (default: builds one from GCC_Compiler.cpp with $CXX or g++)
+set -u
+here=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d); trap 'rm -rf "$work"' EXIT
+cc=${1:-}
+if [ -z "$cc" ]; then
+  cc=$work/eminorcc
+  ${CXX:-g++} -std=gnu++17 -O2 -pthread "$here/../GCC_Compiler.cpp" -o "$cc" || exit 1
+fi
+
+modes=("" "--no-opt" "--regs" "--compact" "--jit" "--threads 4" "--no-opt --regs --compact" "--regs --compact --jit --threads 4")
+runs=0; failed=0
+fail() { echo "FAIL: $*"; failed=$((failed + 1)); }
+
+for src in "$here"/*.eminor; do
+  name=$(basename "$src" .eminor)
+  in=/dev/null; [ -f "$here/$name.in" ] && in=$here/$name.in
+  want=0; [ -f "$here/$name.status" ] && want=$(cat "$here/$name.status")
+  for m in "${modes[@]}"; do
+    runs=$((runs + 1))
+    # shellcheck disable=SC2086 # $m holds several flags
+    "$cc" "$src" -I "$here/lib" -o "$work/run" --no-disasm --run $m < "$in" > "$work/stdout" 2> "$work/stderr"; st=$?
+    if ! cmp -s "$work/stdout" "$here/$name.expected"; then fail "$name [${m:-default}]: output differs"; diff "$here/$name.expected" "$work/stdout" | head -10
+    elif [ "$st" != "$want" ]; then fail "$name [${m:-default}]: exit status $st, expected $want"; head -5 "$work/stderr"; fi
+  done
+  for m in "" "--regs" "--compact" "--no-opt"; do
+    runs=$((runs + 1)); rm -rf "$work/cache" "$work/c0" "$work/c1" "$work/c2"
+    # shellcheck disable=SC2086
+    "$cc" "$src" -I "$here/lib" -o "$work/c0" $m > /dev/null 2>&1 &&
+    "$cc" "$src" -I "$here/lib" -o "$work/c1" --cache "$work/cache" $m > /dev/null 2>&1 &&
+    "$cc" "$src" -I "$here/lib" -o "$work/c2" --cache "$work/cache" $m > /dev/null 2>&1 || { fail "$name [cache ${m:-default}]: build failed"; continue; }
+    diff -r -q "$work/c0" "$work/c1" > /dev/null || fail "$name [cache ${m:-default}]: cold build differs from an uncached one"
+    diff -r -q "$work/c1" "$work/c2" > /dev/null || fail "$name [cache ${m:-default}]: warm build differs from the cold one"
+  done
+done
+
+if [ "$failed" -ne 0 ]; then echo "$failed of $runs checks failed"; exit 1; fi
+echo "ok: $runs checks passed"